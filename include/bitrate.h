@@ -0,0 +1,44 @@
+#ifndef _BITRATE_H_
+#define _BITRATE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * PCR based bitrates, bit/s over a window of one second of PCR time that
+ * slides on every 100 ms. the packet counts of all PIDs are taken at the
+ * start of a batch of packets, where they are exact, and dated by
+ * interpolating the PCRs of the first PCR PID by byte position. the packet
+ * loop only compares the stream offset with bitrate_tick_at once per batch
+ */
+extern uint64_t bitrate_tick_at;
+
+void bitrate_init(void);
+
+/* counts of the packets before stream offset */
+void bitrate_tick(uint64_t offset);
+
+/* first packet of a PID */
+void bitrate_new_pid(uint16_t pid);
+
+void bitrate_pcr(uint16_t pid, uint64_t pcr, int discontinuity, uint64_t offset);
+
+/* pid carries a component, the PCR or the PMT of program */
+void bitrate_program(uint16_t pid, uint16_t program);
+
+/* forget the PIDs of program, before its new PMT is taken in */
+void bitrate_program_reset(uint16_t program);
+
+void dump_bitrate(void);
+
+/* the same through rout(), for the txt and json outputs */
+void dump_bitrate_res(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_BITRATE_H_*/
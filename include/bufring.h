@@ -0,0 +1,64 @@
+#ifndef _BUFRING_H_
+#define _BUFRING_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUFRING_MAX (4)
+
+/*
+ * ring of large buffers between an input thread and ts_process(). the
+ * thread fills the buffers in turn through fill() while the caller works on
+ * an earlier one, a buffer handed out by bufring_read() stays with the caller
+ * until its next read. an empty buffer marks the end of input
+ */
+struct bufring_buf {
+	uint8_t *data;
+	size_t len;
+	int full;
+};
+
+struct bufring {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct bufring_buf buf[BUFRING_MAX];
+	int num;
+	size_t size;
+	/* size bytes or fewer into data, 0 at the end of input, -1 on an error */
+	ssize_t (*fill)(uint8_t *data, size_t size);
+	int cancel; /* fill() may block for good, close() cancels it */
+	int running;
+	int stop;
+	int err; /* fill() failed, set before the empty buffer */
+	int cur; /* buffer owned by the caller, -1 if none */
+	int next; /* buffer handed out on the next read() */
+	int done; /* empty buffer handed out, input is over */
+	uint64_t starved; /* reads that waited for the thread */
+	uint64_t waits; /* times the thread waited for the caller */
+};
+
+/* num buffers of size, aligned to align when not 0, and the thread filling them */
+int bufring_open(struct bufring *r, int num, size_t size, size_t align, ssize_t (*fill)(uint8_t *data, size_t size),
+				 int cancel);
+
+/* -1 at the end of input */
+int bufring_read(struct bufring *r, void **ptr, size_t *len);
+
+/* stops the thread and frees the buffers, also after a failed open */
+void bufring_close(struct bufring *r);
+
+/* 1 until the end of input was handed out, then 0, or -1 when fill() failed */
+int64_t bufring_end(const struct bufring *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_BUFRING_H_*/
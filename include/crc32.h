@@ -7,7 +7,8 @@
 extern "C" {
 #endif
 
-uint32_t crc32(char *data, int len);
+/* MPEG-2 CRC-32, named apart from zlib crc32() which tsanalyze links with */
+uint32_t crc32_mpeg2(char *data, int len);
 
 #ifdef __cplusplus
 }
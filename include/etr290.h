@@ -0,0 +1,88 @@
+#ifndef _ETR290_H_
+#define _ETR290_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ETSI TR 101 290 indicators, priority 1 to 3 in the order of the report */
+enum etr_indicator {
+	ETR_TS_SYNC_LOSS = 0, /* 1.1 */
+	ETR_SYNC_BYTE, /* 1.2 */
+	ETR_PAT, /* 1.3 */
+	ETR_CC, /* 1.4 */
+	ETR_PMT, /* 1.5 */
+	ETR_PID, /* 1.6 */
+	ETR_TRANSPORT, /* 2.1 */
+	ETR_CRC, /* 2.2 */
+	ETR_PCR_REPETITION, /* 2.3a */
+	ETR_PCR_DISCONTINUITY, /* 2.3b */
+	ETR_PCR_ACCURACY, /* 2.4 */
+	ETR_PTS, /* 2.5 */
+	ETR_CAT, /* 2.6 */
+	ETR_NIT, /* 3.1 */
+	ETR_SI_REPETITION, /* 3.2 */
+	ETR_UNREFERENCED_PID, /* 3.4 */
+	ETR_SDT, /* 3.5 */
+	ETR_EIT, /* 3.6 */
+	ETR_TDT, /* 3.8 */
+	ETR_NUM,
+};
+
+/* what the PSI says a PID is */
+enum etr_ref {
+	ETR_REF_PMT = 1 << 0, /* program_map_PID in the PAT */
+	ETR_REF_ES = 1 << 1, /* elementary_PID in a PMT */
+	ETR_REF_PCR = 1 << 2, /* PCR_PID of a PMT */
+	ETR_REF_CA = 1 << 3, /* ECM or EMM PID of a CA_descriptor */
+};
+
+/*
+ * the timed checks run every ETR_TICK of stream time. stream time is the
+ * arrival stamp of the input when it has one, else it is taken from the
+ * first PCR PID and interpolated by byte position. nothing here reads a
+ * clock: the packet loop only compares the stream offset with
+ * etr_tick_at once per batch of packets
+ */
+#define ETR_TICK (100000000ULL) /* ns */
+
+extern uint64_t etr_tick_at;
+
+void etr_init(void);
+
+void etr_error(enum etr_indicator e, uint64_t offset);
+
+void etr_tick(uint64_t offset, uint64_t stamp);
+
+/* ns of stream time since the first PCR at a byte offset, -1 unless timed by PCR */
+int etr_pcr_time(uint64_t offset, uint64_t *ns);
+
+/* first packet of a PID */
+void etr_new_pid(uint16_t pid);
+
+/* a packet with transport_scrambling_control other than 00 */
+void etr_scrambled(uint16_t pid, uint64_t offset);
+
+void etr_pcr(uint16_t pid, uint64_t pcr, int discontinuity, uint64_t offset);
+
+/* payload of a packet that starts a PES packet */
+void etr_pes(uint16_t pid, const uint8_t *data, size_t len, uint64_t offset);
+
+/* a complete section, -1 when it fails its CRC or does not belong on the PID */
+int etr_section(uint16_t pid, const uint8_t *data, uint16_t len, uint64_t offset);
+
+/* the table on PID from refers to pid, etr_unrefer() drops all of its references */
+void etr_refer(uint16_t pid, uint16_t from, enum etr_ref ref);
+
+void etr_unrefer(uint16_t from);
+
+void dump_etr(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_ETR290_H_*/
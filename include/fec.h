@@ -0,0 +1,39 @@
+#ifndef _FEC_H_
+#define _FEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FEC_HEADER_LEN (16)
+
+/*
+ * SMPTE 2022-1 FEC header, it follows the RTP header of a FEC packet.
+ * the packet protects na media packets from base on, offset apart:
+ * columns (port + 2) have offset L and na D, rows (port + 4) offset 1
+ * and na L. the recovery fields are the XOR over the protected packets
+ */
+struct fec_header {
+	uint16_t base; /* first protected sequence number */
+	uint16_t length; /* length recovery, of everything past the fixed RTP header */
+	uint8_t pt; /* payload type recovery */
+	uint32_t ts; /* timestamp recovery */
+	uint8_t row; /* D bit, 1 for the second (row) FEC stream */
+	uint8_t offset;
+	uint8_t na;
+};
+
+/* b points past the RTP header of a FEC packet, -1 if the header is unusable */
+int fec_parse_header(const uint8_t *b, size_t len, struct fec_header *h);
+
+/* dst ^= src over len bytes */
+void fec_xor(uint8_t *dst, const uint8_t *src, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_FEC_H_*/
@@ -12,6 +12,17 @@ enum filter_type {
 	FILTER_PES = 1,
 };
 
+/* what the packet loop does with a PID, flags, kept up to date as filters change */
+enum filter_action {
+	FILTER_ACT_COUNT = 0, /* headers only */
+	FILTER_ACT_PCR = 1 << 0, /* parse the adaptation field */
+	FILTER_ACT_SECTION = 1 << 1, /* reassemble sections */
+	FILTER_ACT_PES = 1 << 2, /* reassemble PES packets */
+	FILTER_ACT_PTS = 1 << 3, /* look at the header of PES packets that start */
+};
+
+extern uint8_t filter_action[];
+
 #define MAX_FILTER_DEPTH 8
 
 typedef struct filter_param
@@ -27,6 +38,7 @@ typedef int (*filter_cb)(uint16_t pid, uint8_t *data, uint16_t len);
 typedef struct filter
 {
 	uint16_t pid;
+	uint8_t type; /* enum filter_type, set before filter_set() */
 	filter_param_t para;
 	filter_cb callback;
 } filter_t;
@@ -43,6 +55,12 @@ int filter_proc(uint16_t pid, uint8_t *data, uint16_t len);
 
 filter_t *filter_lookup(uint16_t pid, filter_param_t *param);
 
+/* the PID carries a PCR the analyzer wants */
+void filter_set_pcr(uint16_t pid, int on);
+
+/* the PID carries PES packets whose timing is checked */
+void filter_set_pts(uint16_t pid, int on);
+
 #ifdef __cplusplus
 }
 #endif
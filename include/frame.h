@@ -0,0 +1,63 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* UDP flow as seen on the wire, ports in host byte order */
+struct flow_key {
+	int family; /* AF_INET or AF_INET6 */
+	uint32_t saddr; /* IPv4 addresses, network order */
+	uint32_t daddr;
+	uint8_t saddr6[16];
+	uint8_t daddr6[16];
+	uint16_t sport;
+	uint16_t dport;
+};
+
+#define FLOW_TABLE_SIZE (256)
+
+struct flow_stat {
+	struct flow_key key;
+	int used;
+	uint64_t pkts;
+	uint64_t bytes;
+};
+
+/* datagram counts per destination */
+struct flow_table {
+	struct flow_stat flows[FLOW_TABLE_SIZE];
+	uint64_t untracked; /* datagrams seen once the table was full */
+};
+
+/*
+ * walk an ethernet frame (802.1Q/802.1ad tags allowed) down to the UDP
+ * payload. return -1 for anything but an unfragmented IPv4/IPv6 datagram
+ */
+int frame_udp_payload(const uint8_t *frame, size_t len, struct flow_key *key, const uint8_t **payload,
+					  size_t *plen);
+
+/* same, starting at the IP header of either version */
+int frame_ip_udp_payload(const uint8_t *ip, size_t len, struct flow_key *key, const uint8_t **payload,
+						 size_t *plen);
+
+/* parse a.b.c.d:port, [v6addr]:port or :port, a missing address or port matches any */
+int flow_parse_dst(const char *str, struct flow_key *key);
+
+/* destination of key matches sel, sel may hold wildcards */
+int flow_dst_match(const struct flow_key *sel, const struct flow_key *key);
+
+/* entry for the destination of key, NULL once the table is full */
+struct flow_stat *flow_lookup(struct flow_table *t, const struct flow_key *key);
+
+void flow_table_dump(const char *title, struct flow_table *t, const struct flow_key *sel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_FRAME_H_*/
@@ -2,28 +2,57 @@
 #define _IO_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* arrival time of the data read from byte at on */
+struct io_stamp {
+	size_t at;
+	uint64_t stamp;
+};
+
 struct io_ops
 {
 	int type;
 	int fd;
-	int block_size;
-	size_t total_size;
-	size_t offset;
+	size_t block_size;
+	uint64_t total_size;
+	uint64_t offset;
 	unsigned char *ptr;
+	/* arrival or capture time of the data last read in ns, 0 when unknown */
+	uint64_t stamp;
+	/* optional, one per datagram of the data last read in the order of at, stamps_num 0 for none */
+	const struct io_stamp *stamps;
+	size_t stamps_num;
 	int (*open)(const char *filename);
+	/* buffer returned stays valid until the next read() or close() */
 	int (*read)(void **ptr, size_t *len);
 	int (*close)(void);
-	int (*end)(void);
+	/* bytes left to read, streams without an end return a positive value, negative when the input failed */
+	int64_t (*end)(void);
+	/* optional, print input side statistics */
+	void (*dump)(void);
+	/* optional, TS packets the continuity counters found missing in the data last read */
+	void (*loss)(uint64_t pkts);
 };
 
 typedef enum {
 	IO_FILE = 0,
 	IO_UDP = 1,
+	IO_URING = 2,
+	IO_DIRECT = 3,
+	IO_RTP = 4,
+	IO_TPACKET = 5,
+	IO_XDP = 6,
+	IO_PCAP = 7,
+	IO_PIPE = 8,
+	IO_SHM = 9,
+	IO_HITLESS = 10,
+	IO_HTTP = 11,
+	IO_ZIP = 12, /* picked for compressed files, not by name */
 } io_enum;
 
 struct io_ops *lookup_io_ops(int type);
@@ -32,6 +61,15 @@ int register_io_ops(struct io_ops *ops);
 
 int unregister_io_ops(struct io_ops *ops);
 
+enum {
+	ZIP_NONE,
+	ZIP_GZIP,
+	ZIP_ZSTD,
+};
+
+/* ZIP_GZIP or ZIP_ZSTD when the file starts with their magic bytes, ZIP_NONE otherwise */
+int zip_probe(const char *filename);
+
 #define REGISTER_IO_OPS(nm, x)                                                                                         \
 	static void __attribute__((constructor)) register_io_ops_##nm(void)                                                \
 	{                                                                                                                  \
@@ -0,0 +1,73 @@
+#ifndef _MDI_H_
+#define _MDI_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MDI_DEFAULT_INTERVAL (1000) /* ms */
+
+/*
+ * RFC 4445 media delivery index. arrivals fill a virtual buffer that drains
+ * at the media rate, DF is the spread of the buffer level over an interval
+ * in ms, MLR the media packets lost or out of order per second.
+ * the drain rate of an interval is the rate measured over the one before
+ */
+struct mdi {
+	uint64_t interval; /* ns */
+	uint64_t start; /* current interval, 0 before the first arrival */
+	uint64_t bytes; /* arrived in the current interval */
+	uint64_t lost; /* lost in the current interval */
+	double rate; /* bytes per ns */
+	double vb_min;
+	double vb_max;
+	uint64_t intervals; /* closed intervals with a DF */
+	uint64_t lost_total;
+	double df;
+	double df_max;
+	double df_sum;
+	double mlr;
+	double mlr_max;
+};
+
+void mdi_init(struct mdi *m, uint32_t interval_ms);
+
+void mdi_interval_end(struct mdi *m, uint64_t now);
+
+/* datagram of bytes media bytes arrived at stamp ns */
+static inline void mdi_arrival(struct mdi *m, uint64_t stamp, size_t bytes)
+{
+	double vb;
+
+	if (m->start == 0 || stamp < m->start)
+		m->start = stamp;
+	else if (stamp - m->start >= m->interval)
+		mdi_interval_end(m, stamp);
+	if (m->rate > 0) {
+		vb = (double)m->bytes - m->rate * (double)(stamp - m->start);
+		if (vb < m->vb_min)
+			m->vb_min = vb;
+		vb += (double)bytes;
+		if (vb > m->vb_max)
+			m->vb_max = vb;
+	}
+	m->bytes += bytes;
+}
+
+/* media packets lost or out of order */
+static inline void mdi_loss(struct mdi *m, uint64_t pkts)
+{
+	m->lost += pkts;
+	m->lost_total += pkts;
+}
+
+void mdi_dump(const char *name, struct mdi *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_MDI_H_*/
@@ -0,0 +1,35 @@
+#ifndef _PCR_H_
+#define _PCR_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * PCR measurements of TR 101 290 5.3.2 per PCR PID. every PID keeps two
+ * least squares lines that are updated in O(1) per PCR: PCR against byte
+ * position, its residuals are PCR_AC, and PCR against arrival time, its
+ * residuals are PCR_OJ and its slope PCR_FO. PCR_DR is the change of the
+ * slope between blocks of arrival time. inputs without arrival time only
+ * get PCR_AC
+ */
+void pcr_init(void);
+
+/* pid is the PCR_PID of program */
+void pcr_program(uint16_t pid, uint16_t program);
+
+/* stamp is the arrival time in ns, 0 when unknown */
+void pcr_sample(uint16_t pid, uint64_t pcr, int discontinuity, uint64_t offset, uint64_t stamp);
+
+void dump_pcr(void);
+
+/* the same through rout(), for the txt and json outputs */
+void dump_pcr_res(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_PCR_H_*/
@@ -0,0 +1,23 @@
+#ifndef _RTP_H_
+#define _RTP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTP_HEADER_LEN (12)
+
+/*
+ * payload offset and length past header, CSRC list, extension and padding.
+ * return -1 if this is no RTP version 2 packet
+ */
+int rtp_parse_header(const uint8_t *b, size_t len, uint16_t *seq, uint16_t *off, uint16_t *plen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_RTP_H_*/
@@ -0,0 +1,65 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * layout of the shared memory ring read by shm:// input. the producer
+ * creates the object with shm_open("/name"), sizes it to at least
+ * data_offset + capacity * packet_size bytes and fills in the header,
+ * magic last. one producer and one consumer, fields are host endian.
+ *
+ *   0   magic, version, packet_size, capacity, data_offset, closed
+ *   64  head, data_seq, prod_wait     written by the producer
+ *   128 tail, space_seq, cons_wait    written by the consumer
+ *   data_offset                       capacity slots of packet_size bytes
+ *
+ * head and tail count packets since the start and never wrap, slot i lives
+ * at data_offset + (i & (capacity - 1)) * packet_size. capacity is a power
+ * of two, packet_size 188, 192 or 204.
+ *
+ * producer: wait until head - tail < capacity, copy packets into the slots,
+ * then publish head with a release store. if cons_wait is set, increment
+ * data_seq and FUTEX_WAKE it. to wait for space, set prod_wait, re-check
+ * tail and FUTEX_WAIT on space_seq. set closed to 1 and wake the consumer
+ * when done.
+ *
+ * consumer: the mirror image, tail is published once the packets are
+ * processed and space_seq woken when prod_wait is set. futexes are shared,
+ * not FUTEX_PRIVATE, and every access to head, tail, the seqs and the wait
+ * flags is sequentially consistent except the release/acquire on head/tail.
+ */
+
+#define SHM_RING_MAGIC (0x47525354) /* "TSRG" */
+#define SHM_RING_VERSION (1)
+#define SHM_RING_CACHELINE (64)
+
+struct shm_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t packet_size;
+	uint32_t capacity; /* packets */
+	uint64_t data_offset; /* from the start of the object, page aligned */
+	uint32_t closed; /* producer will not write any more */
+	uint8_t pad0[SHM_RING_CACHELINE - 28];
+
+	uint64_t head; /* packets written */
+	uint32_t data_seq; /* futex, bumped when packets were published */
+	uint32_t prod_wait; /* producer sleeps on space_seq */
+	uint8_t pad1[SHM_RING_CACHELINE - 16];
+
+	uint64_t tail; /* packets consumed */
+	uint32_t space_seq; /* futex, bumped when slots were released */
+	uint32_t cons_wait; /* consumer sleeps on data_seq */
+	uint8_t pad2[SHM_RING_CACHELINE - 16];
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
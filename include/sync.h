@@ -0,0 +1,31 @@
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ts.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* sync bytes in a row, one packet apart, that acquire lock (TR 101 290) */
+#define TS_SYNC_LOCK (5)
+#define TS_SYNC_WINDOW (TS_SYNC_LOCK * TS_MAX_PACKET_SIZE)
+
+/* offset of the first 0x47 in buf, len when there is none */
+size_t ts_sync_find(const uint8_t *buf, size_t len);
+
+/*
+ * 1 with *off at the first of TS_SYNC_LOCK sync bytes stride apart. 0 when
+ * there is none yet, everything before *off is ruled out and from *off on
+ * more data is needed to decide
+ */
+int ts_sync_lock(const uint8_t *buf, size_t len, size_t stride, size_t *off);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_SYNC_H_*/
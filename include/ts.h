@@ -79,6 +79,12 @@ enum PID_e {
 
 #define SYS_CLK (27000000)
 
+/* PCR wraps at 2^33 * 300 */
+#define PCR_MOD ((1ULL << 33) * 300)
+/* 27 MHz ticks to ns and back */
+#define PCR_NS(t) ((t) * 1000 / 27)
+#define NS_PCR(ns) ((ns) * 27 / 1000)
+
 #define TS_READ8(buff) (*(buff))
 #define TS_READ16(buff) (uint16_t)((((uint16_t) * (buff)) << 8) | ((uint16_t) * (buff + 1)))
 #define TS_READ32(buff)                                                                                                \
@@ -124,12 +130,14 @@ enum PID_e {
 
 struct tsa_config
 {
-	char name[256]; // filename
+	char name[4096]; // filename or list of urls
 	uint8_t pids[TS_MAX_PID + 1];
 	uint8_t type;
 	uint8_t brief : 1;
 	uint8_t detail : 1;
-	uint8_t mem;
+	uint8_t follow : 1; // keep reading a file that is still being written
+	uint32_t mem; // input block size in MB
+	uint32_t mdi_interval; // MDI interval in ms
 	uint8_t tables;
 	uint8_t output;
 };
@@ -138,6 +146,20 @@ struct tsa_config *get_config(void);
 
 #define MAX_TS_PID_NUM 8192
 
+struct pid_ops {
+	uint16_t pid;
+	uint64_t pkts_in;
+	uint64_t error_in;
+	uint64_t bits_in;
+	uint64_t pcr;
+	uint64_t bitrate;
+};
+
+extern struct pid_ops pid_dev[MAX_TS_PID_NUM];
+
+/* 27 MHz ticks of a PCR */
+uint64_t calc_pcr_clock(pcr_clock pcr);
+
 int init_pid_processor(void);
 
 void uninit_pid_processor(void);
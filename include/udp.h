@@ -0,0 +1,63 @@
+#ifndef _UDP_H_
+#define _UDP_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UDP_MAX_DGRAM (2048)
+#define UDP_CMSG_SPACE (64) /* control data received along with a datagram */
+
+struct msghdr;
+
+struct url {
+	char proto[32];
+	uint32_t addr;
+	uint32_t port;
+	uint32_t source; /* SSM source, 0 for any source */
+	uint32_t ifaddr; /* interface to join on, 0 to let the kernel pick */
+	unsigned int ifindex;
+	int busy_poll; /* usecs, 0 to leave SO_BUSY_POLL off */
+	int fec; /* rtp only, receive SMPTE 2022-1 FEC on port + 2 and + 4 */
+};
+
+void parse_url(const char *url, const char *protocl, uint32_t *addr, uint32_t *port);
+
+/* parse proto://[source@]addr:port[?options], NULL if proto does not match */
+struct url *parse_url_path(const char *urlpath, const char *proto);
+
+/* bound datagram socket, multicast groups already joined */
+int udp_socket(struct url *surl);
+
+/*
+ * kernel receive time of a datagram in ns, 0 when it came without one.
+ * the socket drop counter is stored in drops when it was attached
+ */
+uint64_t udp_msg_info(struct msghdr *mh, uint32_t *drops);
+
+/* receive side of a socket: kernel drop counter and buffer sizing */
+struct udp_rx {
+	int fd;
+	int rcvbuf; /* SO_RCVBUF as the kernel reports it */
+	int forced; /* SO_RCVBUFFORCE took, rmem_max does not apply */
+	uint32_t drops; /* datagrams dropped on a full socket buffer */
+	uint32_t seen; /* drops at the last check */
+	uint32_t resized;
+	uint64_t check; /* start of the current rate window */
+	uint64_t bytes; /* bytes in the current rate window */
+};
+
+void udp_rx_init(struct udp_rx *rx, int fd);
+
+/* account a batch, grow the buffer to hold half a second of input, or more on drops */
+void udp_rx_update(struct udp_rx *rx, uint64_t now, uint64_t bytes, uint32_t drops);
+
+void udp_rx_dump(struct udp_rx *rx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_UDP_H_*/
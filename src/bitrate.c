@@ -0,0 +1,291 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bitrate.h"
+#include "result.h"
+#include "ts.h"
+
+#define BITRATE_SLOT (SYS_CLK / 10) /* 100 ms in 27 MHz ticks */
+#define BITRATE_SLOTS (10) /* slots in a window */
+#define BITRATE_PROGRAMS (256)
+
+/* bit/s of the windows, headroom in per mille */
+struct bitrate_stat {
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t windows;
+};
+
+struct bitrate_pid {
+	uint8_t listed;
+	uint64_t since; /* ticks when it was first seen */
+	uint64_t mark[BITRATE_SLOTS]; /* pkts_in at the ticks of the window */
+	uint64_t bits; /* in the last window */
+	struct bitrate_stat st;
+};
+
+/* PIDs may be shared, a PCR PID or an ECM PID counts for every program it is in */
+struct bitrate_prog {
+	uint16_t number;
+	uint64_t pids[MAX_TS_PID_NUM / 64];
+	struct bitrate_stat st;
+};
+
+/* times are 27 MHz ticks, counted on across PCR wraps */
+static struct {
+	/* clock: PCR time now at byte offset at, dpcr ticks in the dbytes before */
+	int clock;
+	uint16_t clock_pid;
+	uint64_t now;
+	uint64_t pcr;
+	uint64_t at;
+	uint64_t dpcr;
+	uint64_t dbytes;
+
+	uint64_t ticks;
+	uint64_t next_tick;
+	uint64_t tick_time[BITRATE_SLOTS];
+	int slot; /* oldest mark, the next one to take */
+	int marks; /* since the window restarted, up to BITRATE_SLOTS */
+
+	struct bitrate_stat mux;
+	struct bitrate_stat headroom;
+	uint16_t listed[MAX_TS_PID_NUM];
+	int listed_num;
+	struct bitrate_pid pid[MAX_TS_PID_NUM];
+	struct bitrate_prog prog[BITRATE_PROGRAMS];
+	int prog_num;
+} br;
+
+uint64_t bitrate_tick_at;
+
+void bitrate_new_pid(uint16_t pid)
+{
+	struct bitrate_pid *p = &br.pid[pid];
+
+	if (p->listed)
+		return;
+	p->listed = 1;
+	p->since = br.ticks;
+	br.listed[br.listed_num++] = pid;
+}
+
+void bitrate_init(void)
+{
+	memset(&br, 0, sizeof(br));
+	bitrate_tick_at = UINT64_MAX;
+	/* its continuity is not followed, nothing else reports it */
+	bitrate_new_pid(NULL_PID);
+}
+
+static struct bitrate_prog *bitrate_prog(uint16_t program)
+{
+	int i;
+
+	for (i = 0; i < br.prog_num; i++) {
+		if (br.prog[i].number == program)
+			return &br.prog[i];
+	}
+	if (br.prog_num == BITRATE_PROGRAMS)
+		return NULL;
+	br.prog[br.prog_num].number = program;
+	return &br.prog[br.prog_num++];
+}
+
+void bitrate_program(uint16_t pid, uint16_t program)
+{
+	struct bitrate_prog *g = bitrate_prog(program);
+
+	if (g != NULL)
+		g->pids[pid / 64] |= 1ULL << (pid % 64);
+}
+
+void bitrate_program_reset(uint16_t program)
+{
+	struct bitrate_prog *g = bitrate_prog(program);
+
+	if (g != NULL)
+		memset(g->pids, 0, sizeof(g->pids));
+}
+
+static void bitrate_add(struct bitrate_stat *st, uint64_t v)
+{
+	if (st->windows == 0 || v < st->min)
+		st->min = v;
+	if (v > st->max)
+		st->max = v;
+	st->sum += v;
+	st->windows++;
+}
+
+/* the window from the oldest mark to now, dt ticks long */
+static void bitrate_window(uint64_t dt)
+{
+	uint64_t bits, mux = 0, rate;
+	struct bitrate_pid *p;
+	struct bitrate_prog *g;
+	uint16_t pid;
+	int i, k;
+
+	for (i = 0; i < br.listed_num; i++) {
+		pid = br.listed[i];
+		p = &br.pid[pid];
+		p->bits = (pid_dev[pid].pkts_in - p->mark[br.slot]) * TS_PACKET_SIZE * 8;
+		mux += p->bits;
+		/* a PID that started within the window would look slower than it is */
+		if (p->since + BITRATE_SLOTS > br.ticks)
+			continue;
+		rate = p->bits * SYS_CLK / dt;
+		bitrate_add(&p->st, rate);
+		pid_dev[pid].bitrate = rate;
+	}
+	for (k = 0; k < br.prog_num; k++) {
+		g = &br.prog[k];
+		bits = 0;
+		for (i = 0; i < br.listed_num; i++) {
+			pid = br.listed[i];
+			if (g->pids[pid / 64] & (1ULL << (pid % 64)))
+				bits += br.pid[pid].bits;
+		}
+		bitrate_add(&g->st, bits * SYS_CLK / dt);
+	}
+	if (mux == 0)
+		return;
+	bitrate_add(&br.mux, mux * SYS_CLK / dt);
+	bitrate_add(&br.headroom, br.pid[NULL_PID].bits * 1000 / mux);
+}
+
+void bitrate_tick(uint64_t offset)
+{
+	uint64_t t;
+	int i;
+
+	bitrate_tick_at = UINT64_MAX;
+	if (br.dbytes == 0 || offset < br.at)
+		return;
+	/* less than a batch of packets past the last PCR */
+	t = br.now + (offset - br.at) * br.dpcr / br.dbytes;
+	if (br.marks == BITRATE_SLOTS && t > br.tick_time[br.slot])
+		bitrate_window(t - br.tick_time[br.slot]);
+	for (i = 0; i < br.listed_num; i++)
+		br.pid[br.listed[i]].mark[br.slot] = pid_dev[br.listed[i]].pkts_in;
+	br.tick_time[br.slot] = t;
+	br.slot = (br.slot + 1) % BITRATE_SLOTS;
+	if (br.marks < BITRATE_SLOTS)
+		br.marks++;
+	br.ticks++;
+	/* on the 100 ms grid unless it fell behind */
+	br.next_tick += BITRATE_SLOT;
+	if (br.next_tick <= t)
+		br.next_tick = t + BITRATE_SLOT;
+}
+
+void bitrate_pcr(uint16_t pid, uint64_t pcr, int discontinuity, uint64_t offset)
+{
+	uint64_t d;
+
+	if (!br.clock) {
+		br.clock = 1;
+		br.clock_pid = pid;
+		br.pcr = pcr;
+		br.at = offset;
+		return;
+	}
+	if (pid != br.clock_pid)
+		return;
+	d = (pcr + PCR_MOD - br.pcr) % PCR_MOD;
+	if (discontinuity || d == 0 || d > BITRATE_SLOT || offset <= br.at) {
+		/* a new time base, a window across it would not mean much */
+		br.dbytes = 0;
+		br.marks = 0;
+		br.next_tick = br.now;
+	} else {
+		br.now += d;
+		br.dpcr = d;
+		br.dbytes = offset - br.at;
+		/* at the start of the next batch */
+		if (br.now >= br.next_tick)
+			bitrate_tick_at = offset + 1;
+	}
+	br.pcr = pcr;
+	br.at = offset;
+}
+
+static uint64_t bitrate_avg(const struct bitrate_stat *st)
+{
+	return st->windows ? st->sum / st->windows : 0;
+}
+
+static void bitrate_permille(char *buf, size_t len, uint64_t v)
+{
+	snprintf(buf, len, "%" PRIu64 ".%" PRIu64 " %%", v / 10, v % 10);
+}
+
+void dump_bitrate(void)
+{
+	const struct bitrate_stat *st;
+	const struct bitrate_stat *h = &br.headroom;
+	char name[24], min[24], avg[24], max[24];
+	int i;
+
+	printf("\n");
+	printf("Bitrate:\n");
+	if (br.mux.windows == 0) {
+		printf("  less than %" PRIu64 " ms of PCR, not measured\n", PCR_NS((uint64_t)BITRATE_SLOT * BITRATE_SLOTS) / 1000000);
+		return;
+	}
+	printf("  bit/s in %" PRIu64 " ms windows every %" PRIu64 " ms, timed by PCR of PID 0x%04x\n",
+		   PCR_NS((uint64_t)BITRATE_SLOT * BITRATE_SLOTS) / 1000000, PCR_NS((uint64_t)BITRATE_SLOT) / 1000000, br.clock_pid);
+	printf("%-16s%14s%14s%14s\n", "", "Min", "Avg", "Max");
+	printf("%-16s%14" PRIu64 "%14" PRIu64 "%14" PRIu64 "\n", "Mux", br.mux.min, bitrate_avg(&br.mux), br.mux.max);
+	bitrate_permille(min, sizeof(min), h->min);
+	bitrate_permille(avg, sizeof(avg), bitrate_avg(h));
+	bitrate_permille(max, sizeof(max), h->max);
+	printf("%-16s%14s%14s%14s\n", "Null headroom", min, avg, max);
+	for (i = 0; i < br.prog_num; i++) {
+		st = &br.prog[i].st;
+		snprintf(name, sizeof(name), "Program %d", br.prog[i].number);
+		printf("%-16s%14" PRIu64 "%14" PRIu64 "%14" PRIu64 "\n", name, st->min, bitrate_avg(st), st->max);
+	}
+	for (i = 0; i < MAX_TS_PID_NUM; i++) {
+		st = &br.pid[i].st;
+		if (st->windows == 0)
+			continue;
+		snprintf(name, sizeof(name), "%04d(0x%04x)", i, i);
+		printf("%-16s%14" PRIu64 "%14" PRIu64 "%14" PRIu64 "\n", name, st->min, bitrate_avg(st), st->max);
+	}
+}
+
+void dump_bitrate_res(void)
+{
+	const struct bitrate_stat *st;
+	const struct bitrate_stat *h = &br.headroom;
+	int i;
+
+	if (br.mux.windows == 0)
+		return;
+	rout(0, "Bitrate");
+	rout(1, "window : %" PRIu64 " ms every %" PRIu64 " ms, PCR_PID 0x%x", PCR_NS((uint64_t)BITRATE_SLOT * BITRATE_SLOTS) / 1000000,
+		 PCR_NS((uint64_t)BITRATE_SLOT) / 1000000, br.clock_pid);
+	rout(1, "mux           : min %" PRIu64 " avg %" PRIu64 " max %" PRIu64 " bit/s", br.mux.min, bitrate_avg(&br.mux),
+		 br.mux.max);
+	rout(1, "null headroom : min %" PRIu64 ".%" PRIu64 "%% avg %" PRIu64 ".%" PRIu64 "%% max %" PRIu64 ".%" PRIu64 "%%",
+		 h->min / 10, h->min % 10, bitrate_avg(h) / 10, bitrate_avg(h) % 10, h->max / 10, h->max % 10);
+	if (br.prog_num) {
+		rout(1, "programs");
+		rout(2, "program_number : min avg max bit/s");
+	}
+	for (i = 0; i < br.prog_num; i++) {
+		st = &br.prog[i].st;
+		rout(2, "%14d : %" PRIu64 " %" PRIu64 " %" PRIu64, br.prog[i].number, st->min, bitrate_avg(st), st->max);
+	}
+	rout(1, "PIDs");
+	rout(2, "PID : min avg max bit/s");
+	for (i = 0; i < MAX_TS_PID_NUM; i++) {
+		st = &br.pid[i].st;
+		if (st->windows)
+			rout(2, "0x%x : %" PRIu64 " %" PRIu64 " %" PRIu64, i, st->min, bitrate_avg(st), st->max);
+	}
+}
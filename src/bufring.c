@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "bufring.h"
+#include "comm.h"
+
+static void *bufring_thread(void *arg)
+{
+	struct bufring *r = arg;
+	int idx = 0, state, stop;
+	ssize_t ret;
+
+	/* close() may cancel the thread, only while it is in fill() */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	for (;;) {
+		pthread_mutex_lock(&r->lock);
+		if (r->buf[idx].full && !r->stop)
+			r->waits++;
+		while (r->buf[idx].full && !r->stop)
+			pthread_cond_wait(&r->cond, &r->lock);
+		stop = r->stop;
+		pthread_mutex_unlock(&r->lock);
+		if (stop)
+			break;
+
+		if (r->cancel)
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+		ret = r->fill(r->buf[idx].data, r->size);
+		if (r->cancel)
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+		pthread_mutex_lock(&r->lock);
+		if (ret < 0) {
+			r->err = 1;
+			ret = 0;
+		}
+		r->buf[idx].len = (size_t)ret;
+		r->buf[idx].full = 1;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+		if (ret == 0)
+			break;
+		idx = (idx + 1) % r->num;
+	}
+	return NULL;
+}
+
+int bufring_open(struct bufring *r, int num, size_t size, size_t align, ssize_t (*fill)(uint8_t *data, size_t size),
+				 int cancel)
+{
+	int i;
+
+	memset(r, 0, sizeof(*r));
+	r->cur = -1;
+	r->num = num < BUFRING_MAX ? num : BUFRING_MAX;
+	r->size = size;
+	r->fill = fill;
+	r->cancel = cancel;
+	for (i = 0; i < r->num; i++) {
+		if (align == 0)
+			r->buf[i].data = malloc(size);
+		else if (posix_memalign((void **)&r->buf[i].data, align, size) != 0)
+			r->buf[i].data = NULL;
+		if (r->buf[i].data == NULL)
+			goto fail;
+	}
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	if (pthread_create(&r->thread, NULL, bufring_thread, r) != 0) {
+		pthread_cond_destroy(&r->cond);
+		pthread_mutex_destroy(&r->lock);
+		goto fail;
+	}
+	r->running = 1;
+	return 0;
+
+fail:
+	bufring_close(r);
+	return -1;
+}
+
+int bufring_read(struct bufring *r, void **ptr, size_t *len)
+{
+	struct bufring_buf *b;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->cur >= 0) {
+		r->buf[r->cur].full = 0;
+		r->cur = -1;
+		pthread_cond_broadcast(&r->cond);
+	}
+	b = &r->buf[r->next];
+	if (!b->full)
+		r->starved++;
+	while (!b->full)
+		pthread_cond_wait(&r->cond, &r->lock);
+	if (unlikely(b->len == 0)) {
+		r->done = 1;
+		pthread_mutex_unlock(&r->lock);
+		*ptr = NULL;
+		*len = 0;
+		return -1;
+	}
+	r->cur = r->next;
+	r->next = (r->next + 1) % r->num;
+	pthread_mutex_unlock(&r->lock);
+
+	*ptr = b->data;
+	*len = b->len;
+	return 0;
+}
+
+void bufring_close(struct bufring *r)
+{
+	int i;
+
+	if (r->running) {
+		pthread_mutex_lock(&r->lock);
+		r->stop = 1;
+		pthread_cond_broadcast(&r->cond);
+		/* fill() may sit in read() on a pipe nobody writes to */
+		if (r->cancel && !r->done)
+			pthread_cancel(r->thread);
+		pthread_mutex_unlock(&r->lock);
+		pthread_join(r->thread, NULL);
+		pthread_cond_destroy(&r->cond);
+		pthread_mutex_destroy(&r->lock);
+		r->running = 0;
+	}
+	for (i = 0; i < BUFRING_MAX; i++) {
+		free(r->buf[i].data);
+		r->buf[i].data = NULL;
+	}
+}
+
+int64_t bufring_end(const struct bufring *r)
+{
+	/* err is set before the empty buffer that set done was handed out */
+	if (!r->done)
+		return 1;
+	return r->err ? -1 : 0;
+}
@@ -36,7 +36,7 @@ static uint32_t crc_table[256] = {
 	0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-uint32_t crc32(char *data, int len)
+uint32_t crc32_mpeg2(char *data, int len)
 {
 	register int i;
 	uint32_t crc = 0xffffffff;
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bufring.h"
+#include "io.h"
+#include "ts.h"
+
+/*
+ * file input bypassing the page cache: a bufring thread fills one aligned
+ * buffer with O_DIRECT reads while ts_process() consumes the other one.
+ * buffers hold consecutive file blocks, so a packet split between them is
+ * stitched by the pkt_con handling in ts_process() like any other read.
+ */
+
+#define DIRECT_ALIGN (4096)
+#define DIRECT_DEFAULT_BLOCK (8 * 1024 * 1024)
+
+static struct io_ops direct_ops;
+
+static struct {
+	struct bufring ring;
+	uint64_t off; /* next file offset to read */
+	int eof; /* short read seen */
+	int cached; /* O_DIRECT refused, drop pages after reading instead */
+} dio;
+
+static ssize_t direct_fill(uint8_t *data, size_t size)
+{
+	uint64_t off = dio.off;
+	size_t got = 0;
+	ssize_t ret;
+
+	/* after a short read the next offset is not aligned, do not read on */
+	if (dio.eof)
+		return 0;
+	while (got < size) {
+		ret = pread(direct_ops.fd, data + got, size - got, (off_t)(off + got));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EINVAL && !dio.cached && off + got == 0) {
+			/* filesystem without O_DIRECT support, only the first read at offset 0 tells */
+			int fl = fcntl(direct_ops.fd, F_GETFL);
+			if (fcntl(direct_ops.fd, F_SETFL, fl & ~O_DIRECT) < 0) {
+				printf("direct: cannot read without O_DIRECT %s\n", strerror(errno));
+				return -1;
+			}
+			dio.cached = 1;
+			continue;
+		}
+		if (ret < 0) {
+			printf("direct: read error %s\n", strerror(errno));
+			return -1;
+		}
+		if ((size_t)ret < size - got) {
+			/* a short read of a regular file is its end */
+			got += (size_t)ret;
+			dio.eof = 1;
+			break;
+		}
+		got += (size_t)ret;
+	}
+	if (dio.cached)
+		posix_fadvise(direct_ops.fd, (off_t)off, (off_t)got, POSIX_FADV_DONTNEED);
+	dio.off += got;
+	return (ssize_t)got;
+}
+
+static int directio_close(void);
+
+static int directio_open(const char *filename)
+{
+	struct tsa_config *tsaconf = get_config();
+	struct stat st;
+
+	if (filename == NULL)
+		return -1;
+	memset(&dio, 0, sizeof(dio));
+	direct_ops.fd = open(filename, O_RDONLY | O_DIRECT);
+	if (direct_ops.fd < 0 && errno == EINVAL) {
+		direct_ops.fd = open(filename, O_RDONLY);
+		dio.cached = 1;
+	}
+	if (direct_ops.fd < 0)
+		return -1;
+	if (fstat(direct_ops.fd, &st) < 0)
+		goto fail;
+	direct_ops.total_size = (uint64_t)st.st_size;
+	direct_ops.offset = 0;
+	direct_ops.block_size = DIRECT_DEFAULT_BLOCK;
+	if (tsaconf->mem)
+		direct_ops.block_size = (size_t)tsaconf->mem * 1024 * 1024;
+	direct_ops.block_size = (direct_ops.block_size + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+
+	if (bufring_open(&dio.ring, 2, direct_ops.block_size, DIRECT_ALIGN, direct_fill, 0) < 0)
+		goto fail;
+	return 0;
+
+fail:
+	directio_close();
+	return -1;
+}
+
+static int directio_read(void **ptr, size_t *len)
+{
+	if (bufring_read(&dio.ring, ptr, len) < 0)
+		return -1;
+	direct_ops.ptr = *ptr;
+	direct_ops.offset += *len;
+	return 0;
+}
+
+static int directio_close(void)
+{
+	bufring_close(&dio.ring);
+	if (direct_ops.fd >= 0)
+		close(direct_ops.fd);
+	direct_ops.fd = -1;
+	direct_ops.ptr = NULL;
+	direct_ops.offset = 0;
+	return 0;
+}
+
+static int64_t directio_end(void)
+{
+	if (bufring_end(&dio.ring) < 0)
+		return -1;
+	return (int64_t)(direct_ops.total_size - direct_ops.offset);
+}
+
+static struct io_ops direct_ops = {
+	.type = IO_DIRECT,
+	.fd = -1,
+	.open = directio_open,
+	.read = directio_read,
+	.close = directio_close,
+	.end = directio_end,
+};
+
+REGISTER_IO_OPS(direct, &direct_ops);
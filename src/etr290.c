@@ -0,0 +1,539 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "etr290.h"
+#include "pes.h"
+#include "table.h"
+#include "ts.h"
+
+/*
+ * ETSI TR 101 290 measurement guidelines, first to third priority. the
+ * checks on single packets and sections run where those are handled, the
+ * ones on gaps between them (a table or PID that stays away too long) on
+ * every tick of stream time. buffer_error, empty_buffer and data_delay
+ * need a T-STD model and RST_error an RST filter, they are not covered
+ */
+
+#define ETR_MS (1000000ULL)
+#define ETR_SECOND (1000 * ETR_MS)
+
+#define ETR_PID_TIMEOUT (5 * ETR_SECOND) /* PID_error, user defined in TR 101 290 */
+
+static const char *etr_names[ETR_NUM][2] = {
+	{ "1.1", "TS_sync_loss" },
+	{ "1.2", "Sync_byte_error" },
+	{ "1.3", "PAT_error" },
+	{ "1.4", "Continuity_count_error" },
+	{ "1.5", "PMT_error" },
+	{ "1.6", "PID_error" },
+	{ "2.1", "Transport_error" },
+	{ "2.2", "CRC_error" },
+	{ "2.3a", "PCR_repetition_error" },
+	{ "2.3b", "PCR_discontinuity_error" },
+	{ "2.4", "PCR_accuracy_error" },
+	{ "2.5", "PTS_error" },
+	{ "2.6", "CAT_error" },
+	{ "3.1", "NIT_error" },
+	{ "3.2", "SI_repetition_error" },
+	{ "3.4", "Unreferenced_PID" },
+	{ "3.5", "SDT_error" },
+	{ "3.6", "EIT_error" },
+	{ "3.8", "TDT_error" },
+};
+
+/* tables with a repetition rate to keep */
+enum etr_table {
+	T_PAT = 0,
+	T_NIT_ACTUAL,
+	T_NIT_OTHER,
+	T_SDT_ACTUAL,
+	T_SDT_OTHER,
+	T_BAT,
+	T_EIT_ACTUAL_0,
+	T_EIT_ACTUAL_1,
+	T_EIT_OTHER,
+	T_TDT,
+	T_TOT,
+	T_NUM,
+};
+
+/*
+ * longest gap between two sections of a table, shortest between two first
+ * sections (0 for no limit) from TR 101 290 and TR 101 211. tables that are
+ * not required are checked once they were seen
+ */
+static const struct {
+	uint64_t max;
+	uint64_t min;
+	enum etr_indicator e; /* besides SI_repetition_error, ETR_NUM for none */
+	uint8_t si;
+	uint8_t required;
+} etr_timers[T_NUM] = {
+	[T_PAT] = { 500 * ETR_MS, 0, ETR_PAT, 0, 1 },
+	[T_NIT_ACTUAL] = { 10 * ETR_SECOND, 25 * ETR_MS, ETR_NIT, 1, 1 },
+	[T_NIT_OTHER] = { 10 * ETR_SECOND, 0, ETR_NUM, 1, 0 },
+	[T_SDT_ACTUAL] = { 2 * ETR_SECOND, 25 * ETR_MS, ETR_SDT, 1, 1 },
+	[T_SDT_OTHER] = { 10 * ETR_SECOND, 0, ETR_NUM, 1, 0 },
+	[T_BAT] = { 10 * ETR_SECOND, 0, ETR_NUM, 1, 0 },
+	[T_EIT_ACTUAL_0] = { 2 * ETR_SECOND, 0, ETR_EIT, 1, 1 },
+	[T_EIT_ACTUAL_1] = { 2 * ETR_SECOND, 0, ETR_EIT, 1, 1 },
+	[T_EIT_OTHER] = { 10 * ETR_SECOND, 0, ETR_NUM, 1, 0 },
+	[T_TDT] = { 30 * ETR_SECOND, 25 * ETR_MS, ETR_TDT, 1, 1 },
+	[T_TOT] = { 30 * ETR_SECOND, 0, ETR_NUM, 1, 0 },
+};
+
+enum etr_clock_source {
+	ETR_CLOCK_NONE = 0,
+	ETR_CLOCK_PCR,
+	ETR_CLOCK_ARRIVAL,
+};
+
+enum etr_pid_flag {
+	ETR_LISTED = 1 << 0,
+	ETR_UNREFERENCED = 1 << 1, /* reported */
+	ETR_HAS_PCR = 1 << 2,
+	ETR_HAS_PCR_RATE = 1 << 3,
+};
+
+/* stream times are ns, 0 is never */
+struct etr_pid {
+	uint8_t ref; /* enum etr_ref */
+	uint8_t flags; /* enum etr_pid_flag */
+	uint16_t owner; /* PID of the table that referred to it */
+	uint64_t packets; /* pkts_in at the last tick */
+	uint64_t first; /* first tick that saw packets */
+	uint64_t seen; /* last tick that saw new packets */
+	uint64_t section; /* last PMT section */
+	uint64_t pts;
+	uint64_t pcr;
+	uint64_t pcr_at; /* byte offset */
+	uint64_t pcr_time;
+	uint64_t pcr_prev;
+	uint64_t pcr_prev_at;
+};
+
+static struct {
+	uint64_t count[ETR_NUM];
+	uint64_t first_at[ETR_NUM];
+	uint64_t last_at[ETR_NUM];
+
+	/* stream time, PCR based: base at byte base_off, rate bytes per second */
+	int source;
+	uint16_t clock_pid;
+	uint64_t base;
+	uint64_t base_off;
+	uint64_t base_pcr;
+	uint64_t rate;
+	uint64_t stamp;
+	uint64_t start;
+	uint64_t now; /* at the last tick */
+	uint64_t next_tick;
+
+	uint64_t table[T_NUM]; /* last section */
+	uint64_t table_first[T_NUM]; /* last section 0 */
+	int scrambled;
+	int cat;
+	uint64_t cat_checked;
+
+	uint16_t listed[MAX_TS_PID_NUM];
+	int listed_num;
+	struct etr_pid pid[MAX_TS_PID_NUM];
+} etr;
+
+uint64_t etr_tick_at;
+
+void etr_init(void)
+{
+	memset(&etr, 0, sizeof(etr));
+	etr_tick_at = 0;
+}
+
+static uint64_t etr_since(uint64_t now, uint64_t then)
+{
+	return now > then ? now - then : 0;
+}
+
+/* stream time at a byte offset, 0 while there is none */
+static uint64_t etr_clock(uint64_t offset)
+{
+	uint64_t d;
+
+	if (etr.source == ETR_CLOCK_ARRIVAL)
+		return etr.stamp;
+	if (etr.source == ETR_CLOCK_NONE)
+		return 0;
+	if (etr.rate == 0 || offset <= etr.base_off)
+		return etr.base;
+	d = offset - etr.base_off;
+	return etr.base + d / etr.rate * ETR_SECOND + d % etr.rate * ETR_SECOND / etr.rate;
+}
+
+void etr_error(enum etr_indicator e, uint64_t offset)
+{
+	if (etr.count[e] == 0)
+		etr.first_at[e] = offset;
+	etr.count[e]++;
+	etr.last_at[e] = offset;
+}
+
+static void etr_list(uint16_t pid)
+{
+	struct etr_pid *p = &etr.pid[pid];
+
+	if (p->flags & ETR_LISTED)
+		return;
+	p->flags |= ETR_LISTED;
+	etr.listed[etr.listed_num++] = pid;
+}
+
+void etr_new_pid(uint16_t pid)
+{
+	etr_list(pid);
+}
+
+void etr_refer(uint16_t pid, uint16_t from, enum etr_ref ref)
+{
+	struct etr_pid *p = &etr.pid[pid];
+
+	if (pid == NULL_PID)
+		return;
+	etr_list(pid);
+	p->ref |= (uint8_t)ref;
+	p->owner = from;
+	/* watched for PID_error from now on */
+	if (p->seen == 0)
+		p->seen = etr.now;
+}
+
+void etr_unrefer(uint16_t from)
+{
+	int i;
+
+	for (i = 0; i < etr.listed_num; i++) {
+		if (etr.pid[etr.listed[i]].owner == from)
+			etr.pid[etr.listed[i]].ref = 0;
+	}
+}
+
+void etr_scrambled(uint16_t pid, uint64_t offset)
+{
+	if (pid == PAT_PID)
+		etr_error(ETR_PAT, offset);
+	else if (etr.pid[pid].ref & ETR_REF_PMT)
+		etr_error(ETR_PMT, offset);
+	etr.scrambled = 1;
+}
+
+static void etr_clock_start(uint64_t t)
+{
+	etr.start = t;
+	etr.now = t;
+	etr.next_tick = t;
+}
+
+/* the PCR of the clock PID moves stream time on */
+static void etr_clock_pcr(uint64_t pcr, int discontinuity, uint64_t offset)
+{
+	uint64_t d;
+
+	if (etr.source == ETR_CLOCK_NONE) {
+		etr.source = ETR_CLOCK_PCR;
+		/* anything but 0, which is never */
+		etr.base = ETR_SECOND;
+		etr.base_off = offset;
+		etr.base_pcr = pcr;
+		etr_clock_start(etr.base);
+		etr_tick_at = offset;
+		return;
+	}
+	d = (pcr + PCR_MOD - etr.base_pcr) % PCR_MOD;
+	if (discontinuity || d == 0 || d > NS_PCR(100 * ETR_MS) || offset <= etr.base_off) {
+		/* carry on at the last rate */
+		etr.base = etr_clock(offset);
+	} else {
+		etr.rate = (offset - etr.base_off) * SYS_CLK / d;
+		etr.base += PCR_NS(d);
+	}
+	etr.base_off = offset;
+	etr.base_pcr = pcr;
+}
+
+void etr_pcr(uint16_t pid, uint64_t pcr, int discontinuity, uint64_t offset)
+{
+	struct etr_pid *p = &etr.pid[pid];
+	uint64_t now, d, expect, err;
+
+	if (etr.source != ETR_CLOCK_ARRIVAL) {
+		if (etr.source == ETR_CLOCK_NONE)
+			etr.clock_pid = pid;
+		if (pid == etr.clock_pid)
+			etr_clock_pcr(pcr, discontinuity, offset);
+	}
+	now = etr_clock(offset);
+
+	if (!(p->flags & ETR_HAS_PCR) || discontinuity) {
+		p->flags = (uint8_t)((p->flags | ETR_HAS_PCR) & ~ETR_HAS_PCR_RATE);
+		goto done;
+	}
+	if (now && p->pcr_time && etr_since(now, p->pcr_time) > 40 * ETR_MS)
+		etr_error(ETR_PCR_REPETITION, offset);
+	d = (pcr + PCR_MOD - p->pcr) % PCR_MOD;
+	if (d > NS_PCR(100 * ETR_MS)) {
+		/* backwards or too far ahead */
+		etr_error(ETR_PCR_DISCONTINUITY, offset);
+		p->flags &= (uint8_t)~ETR_HAS_PCR_RATE;
+		goto done;
+	}
+	/* the PCR the byte rate since the one before predicts, at the constant bitrate TR 101 290 assumes */
+	if ((p->flags & ETR_HAS_PCR_RATE) && p->pcr_at > p->pcr_prev_at) {
+		expect = (p->pcr - p->pcr_prev + PCR_MOD) % PCR_MOD;
+		expect = expect * (offset - p->pcr_at) / (p->pcr_at - p->pcr_prev_at);
+		err = d > expect ? d - expect : expect - d;
+		if (PCR_NS(err) > 500)
+			etr_error(ETR_PCR_ACCURACY, offset);
+	}
+	p->flags |= ETR_HAS_PCR_RATE;
+done:
+	p->pcr_prev = p->pcr;
+	p->pcr_prev_at = p->pcr_at;
+	p->pcr = pcr;
+	p->pcr_at = offset;
+	p->pcr_time = now;
+}
+
+void etr_pes(uint16_t pid, const uint8_t *data, size_t len, uint64_t offset)
+{
+	struct etr_pid *p = &etr.pid[pid];
+	uint64_t now;
+
+	if (len < 9 || data[0] != 0 || data[1] != 0 || data[2] != 1)
+		return;
+	switch (data[3]) {
+	case stream_id_program_stream_map:
+	case stream_id_padding_stream:
+	case stream_id_private_stream_2:
+	case stream_id_ECM_stream:
+	case stream_id_EMM_stream:
+	case stream_id_program_stream_directory:
+	case stream_id_H222_DSMCC_stream:
+	case stream_id_H222_typeE_stream:
+		return;
+	}
+	/* PTS_DTS_flags */
+	if (!(data[7] & 0x80))
+		return;
+	now = etr_clock(offset);
+	if (now == 0)
+		return;
+	if (p->pts && etr_since(now, p->pts) > 700 * ETR_MS)
+		etr_error(ETR_PTS, offset);
+	p->pts = now;
+}
+
+static void etr_table_seen(enum etr_table t, int first, uint64_t now, uint64_t offset)
+{
+	if (now == 0)
+		return;
+	etr.table[t] = now;
+	if (!first)
+		return;
+	if (etr_timers[t].min && etr.table_first[t] && etr_since(now, etr.table_first[t]) < etr_timers[t].min) {
+		if (etr_timers[t].e != ETR_NUM)
+			etr_error(etr_timers[t].e, offset);
+		etr_error(ETR_SI_REPETITION, offset);
+	}
+	etr.table_first[t] = now;
+}
+
+int etr_section(uint16_t pid, const uint8_t *data, uint16_t len, uint64_t offset)
+{
+	uint8_t tid = data[0];
+	int syntax = data[1] >> 7, first;
+	uint64_t now;
+
+	if (len < 3)
+		return -1;
+	/* the TOT has a CRC without the long syntax */
+	if ((syntax || tid == TOT_TID) && len >= 7 && crc32_mpeg2((char *)data, len) != 0) {
+		etr_error(ETR_CRC, offset);
+		return -1;
+	}
+	first = !syntax || (len > 6 && data[6] == 0);
+	now = etr_clock(offset);
+
+	switch (pid) {
+	case PAT_PID:
+		if (tid == PAT_TID)
+			etr_table_seen(T_PAT, first, now, offset);
+		else
+			etr_error(ETR_PAT, offset);
+		break;
+	case CAT_PID:
+		if (tid == CAT_TID)
+			etr.cat = 1;
+		else
+			etr_error(ETR_CAT, offset);
+		break;
+	case NIT_PID:
+		if (tid == NIT_ACTUAL_TID)
+			etr_table_seen(T_NIT_ACTUAL, first, now, offset);
+		else if (tid == NIT_OTHER_TID)
+			etr_table_seen(T_NIT_OTHER, first, now, offset);
+		else if (tid != ST_TID)
+			etr_error(ETR_NIT, offset);
+		break;
+	case SDT_PID:
+		if (tid == SDT_ACTUAL_TID)
+			etr_table_seen(T_SDT_ACTUAL, first, now, offset);
+		else if (tid == SDT_OTHER_TID)
+			etr_table_seen(T_SDT_OTHER, first, now, offset);
+		else if (tid == BAT_TID)
+			etr_table_seen(T_BAT, first, now, offset);
+		else if (tid != ST_TID)
+			etr_error(ETR_SDT, offset);
+		break;
+	case EIT_PID:
+		/* one p/f sub-table per service, no shortest gap */
+		if (tid == EIT_ACTUAL_TID && len > 6 && data[6] <= 1)
+			etr_table_seen(data[6] ? T_EIT_ACTUAL_1 : T_EIT_ACTUAL_0, 0, now, offset);
+		else if (tid == EIT_OTHER_TID)
+			etr_table_seen(T_EIT_OTHER, 0, now, offset);
+		else if ((tid < EIT_ACTUAL_TID || tid > 0x6F) && tid != ST_TID)
+			etr_error(ETR_EIT, offset);
+		break;
+	case TDT_PID:
+		if (tid == TDT_TID)
+			etr_table_seen(T_TDT, first, now, offset);
+		else if (tid == TOT_TID)
+			etr_table_seen(T_TOT, first, now, offset);
+		else if (tid != ST_TID)
+			etr_error(ETR_TDT, offset);
+		break;
+	default:
+		if (tid == PMT_TID && (etr.pid[pid].ref & ETR_REF_PMT) && now)
+			etr.pid[pid].section = now;
+		break;
+	}
+	return 0;
+}
+
+static void etr_table_due(enum etr_table t, uint64_t now, uint64_t offset)
+{
+	uint64_t last = etr.table[t];
+
+	if (last == 0) {
+		if (!etr_timers[t].required)
+			return;
+		last = etr.start;
+	}
+	if (etr_since(now, last) <= etr_timers[t].max)
+		return;
+	if (etr_timers[t].e != ETR_NUM)
+		etr_error(etr_timers[t].e, offset);
+	if (etr_timers[t].si)
+		etr_error(ETR_SI_REPETITION, offset);
+	/* the next one after another full gap */
+	etr.table[t] = now;
+}
+
+/* everything that is late at now */
+static void etr_check(uint64_t now, uint64_t offset)
+{
+	struct etr_pid *p;
+	uint16_t pid;
+	int i;
+
+	for (i = 0; i < T_NUM; i++)
+		etr_table_due((enum etr_table)i, now, offset);
+
+	for (i = 0; i < etr.listed_num; i++) {
+		pid = etr.listed[i];
+		p = &etr.pid[pid];
+		if (pid_dev[pid].pkts_in != p->packets) {
+			p->packets = pid_dev[pid].pkts_in;
+			p->seen = now;
+			if (p->first == 0)
+				p->first = now;
+		}
+		if (p->ref & ETR_REF_PMT) {
+			if (etr_since(now, p->section ? p->section : etr.start) > 500 * ETR_MS) {
+				etr_error(ETR_PMT, offset);
+				p->section = now;
+			}
+		}
+		if (p->ref & (ETR_REF_ES | ETR_REF_PCR)) {
+			if (etr_since(now, p->seen ? p->seen : etr.start) > ETR_PID_TIMEOUT) {
+				etr_error(ETR_PID, offset);
+				p->seen = now;
+			}
+		} else if (p->ref == 0 && pid >= 0x20 && pid != NULL_PID && p->first && !(p->flags & ETR_UNREFERENCED) &&
+				   etr_since(now, p->first) > 500 * ETR_MS) {
+			etr_error(ETR_UNREFERENCED_PID, offset);
+			p->flags |= ETR_UNREFERENCED;
+		}
+	}
+
+	if (etr.scrambled && !etr.cat && etr_since(now, etr.cat_checked) > 500 * ETR_MS) {
+		etr_error(ETR_CAT, offset);
+		etr.cat_checked = now;
+	}
+}
+
+void etr_tick(uint64_t offset, uint64_t stamp)
+{
+	uint64_t now;
+
+	if (stamp) {
+		etr.stamp = stamp;
+		if (etr.source != ETR_CLOCK_ARRIVAL) {
+			etr.source = ETR_CLOCK_ARRIVAL;
+			etr_clock_start(stamp);
+		}
+		/* look again with the next batch, the stamp moves on with each read */
+		etr_tick_at = offset;
+	} else if (etr.source == ETR_CLOCK_PCR) {
+		etr_tick_at = offset + (etr.rate ? etr.rate * ETR_TICK / ETR_SECOND : TS_PACKET_SIZE);
+	} else {
+		/* nothing to time with until a PCR comes */
+		etr_tick_at = UINT64_MAX;
+		return;
+	}
+	now = etr_clock(offset);
+	if (now < etr.next_tick)
+		return;
+	etr.now = now;
+	etr.next_tick = now + ETR_TICK;
+	etr_check(now, offset);
+}
+
+int etr_pcr_time(uint64_t offset, uint64_t *ns)
+{
+	if (etr.source != ETR_CLOCK_PCR)
+		return -1;
+	*ns = etr_since(etr_clock(offset), etr.start);
+	return 0;
+}
+
+void dump_etr(void)
+{
+	int i;
+
+	printf("\n");
+	printf("TR 101 290:\n");
+	if (etr.source == ETR_CLOCK_ARRIVAL)
+		printf("  timed by arrival time\n");
+	else if (etr.source == ETR_CLOCK_PCR)
+		printf("  timed by PCR of PID 0x%04x\n", etr.clock_pid);
+	else
+		printf("  no PCR and no arrival time, timed checks skipped\n");
+	printf("%-6s%-26s%12s%16s%16s\n", "", "Indicator", "Count", "First at", "Last at");
+	for (i = 0; i < ETR_NUM; i++) {
+		if (etr.count[i])
+			printf("%-6s%-26s%12" PRIu64 "%16" PRIu64 "%16" PRIu64 "\n", etr_names[i][0], etr_names[i][1],
+				   etr.count[i], etr.first_at[i], etr.last_at[i]);
+		else
+			printf("%-6s%-26s%12d%16s%16s\n", etr_names[i][0], etr_names[i][1], 0, "-", "-");
+	}
+}
@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "fec.h"
+#include "ts.h"
+
+int fec_parse_header(const uint8_t *b, size_t len, struct fec_header *h)
+{
+	if (unlikely(len < FEC_HEADER_LEN))
+		return -1;
+	h->base = TS_READ16(b);
+	h->length = TS_READ16(b + 2);
+	h->pt = b[4] & 0x7F;
+	h->ts = TS_READ32(b + 8);
+	h->row = (b[12] >> 6) & 0x01;
+	h->offset = b[13];
+	h->na = b[14];
+	/* only XOR (type 0) is defined, a packet protects at least one */
+	if (((b[12] >> 3) & 0x07) != 0 || h->offset == 0 || h->na == 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * wide XOR: 64 bytes per step with vector extensions, the compiler turns
+ * them into SSE2/NEON pairs or one AVX2 register pair. on x86 an AVX2
+ * clone is picked at load time when the cpu has it
+ */
+typedef uint8_t fec_vec __attribute__((vector_size(32)));
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+void fec_xor(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	fec_vec a0, a1, b0, b1;
+	size_t i = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		memcpy(&a0, dst + i, 32);
+		memcpy(&a1, dst + i + 32, 32);
+		memcpy(&b0, src + i, 32);
+		memcpy(&b1, src + i + 32, 32);
+		a0 ^= b0;
+		a1 ^= b1;
+		memcpy(dst + i, &a0, 32);
+		memcpy(dst + i + 32, &a1, 32);
+	}
+	for (; i < len; i++)
+		dst[i] ^= src[i];
+}
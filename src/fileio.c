@@ -1,75 +1,271 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <sys/inotify.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "comm.h"
 #include "io.h"
 #include "ts.h"
 
+#define FILEIO_DEFAULT_BLOCK (8 * 1024 * 1024)
+
 static struct io_ops file_ops;
 
+/*
+ * the whole file is mapped once when the address space allows it, reads then
+ * only hand out windows of block_size. otherwise fall back to sliding windows
+ * of block_size, each one mapped at a page aligned file offset.
+ *
+ * in follow mode reads at the end of the file wait on inotify for the
+ * recorder to append, then the mapping is extended and whatever arrived is
+ * handed out. the analyzer keeps running, so no state is lost between
+ * appends. following ends when the file is deleted, moved or truncated.
+ */
+static struct {
+	int whole;
+	uint8_t *map;
+	size_t map_len;
+	uint64_t prev; /* offset of the window handed out last */
+	int follow;
+	int ifd; /* inotify, -1 when not following */
+	int gone; /* file was deleted or moved away */
+} fmap;
+
+static size_t fileio_block_size(void)
+{
+	struct tsa_config *tsaconf = get_config();
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = FILEIO_DEFAULT_BLOCK;
+
+	if (tsaconf->mem)
+		size = (size_t)tsaconf->mem * 1024 * 1024;
+	/* windows must start on page boundary */
+	return (size + page - 1) / page * page;
+}
+
+static int fileio_close(void);
+
 static int fileio_open(const char *filename)
 {
+	struct stat st;
 	if (filename == NULL)
 		return -1;
 	file_ops.fd = open(filename, O_RDONLY);
 	if (file_ops.fd < 0)
 		return -1;
-	file_ops.total_size = lseek(file_ops.fd, 0, SEEK_END);
+	if (fstat(file_ops.fd, &st) < 0) {
+		close(file_ops.fd);
+		file_ops.fd = -1;
+		return -1;
+	}
+	file_ops.total_size = (uint64_t)st.st_size;
 	file_ops.ptr = NULL;
-	file_ops.block_size = 2048 * 1024;
+	file_ops.block_size = fileio_block_size();
 	file_ops.offset = 0;
+
+	fmap.whole = 0;
+	fmap.map = NULL;
+	fmap.map_len = 0;
+	fmap.prev = 0;
+	fmap.gone = 0;
+	fmap.ifd = -1;
+	fmap.follow = get_config()->follow;
+	if (fmap.follow) {
+		fmap.ifd = inotify_init1(IN_CLOEXEC);
+		if (fmap.ifd < 0 || inotify_add_watch(fmap.ifd, filename, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+			fileio_close();
+			return -1;
+		}
+		/* a recording that has not started yet grows a mapping later */
+		if (file_ops.total_size == 0 && sizeof(size_t) >= sizeof(uint64_t))
+			fmap.whole = 1;
+	}
+
+	posix_fadvise(file_ops.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (file_ops.total_size > 0 && file_ops.total_size <= SIZE_MAX) {
+		fmap.map = mmap(NULL, (size_t)file_ops.total_size, PROT_READ, MAP_SHARED, file_ops.fd, 0);
+		if (fmap.map != MAP_FAILED) {
+			fmap.whole = 1;
+			fmap.map_len = (size_t)file_ops.total_size;
+			madvise(fmap.map, fmap.map_len, MADV_SEQUENTIAL);
+		} else {
+			fmap.map = NULL;
+		}
+	}
 	return 0;
 }
 
-static int fileio_read(void **ptr, size_t *len)
+static inline uint64_t fileio_page_down(uint64_t off)
+{
+	uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+	return off / page * page;
+}
+
+/* kick readahead for the window after the one being handed out */
+static void fileio_prefetch(uint64_t off)
 {
 	size_t size = file_ops.block_size;
-	if (file_ops.ptr != NULL) {
-		if (munmap(file_ops.ptr, size) < 0) {
+	if (off >= file_ops.total_size)
+		return;
+	if (file_ops.total_size - off < size)
+		size = file_ops.total_size - off;
+	if (fmap.whole) {
+		uint64_t start = fileio_page_down(off);
+		madvise(fmap.map + start, size + (off - start), MADV_WILLNEED);
+	} else {
+		readahead(file_ops.fd, (off64_t)off, size);
+	}
+}
+
+/* wait until the file grew past offset, -1 once it will not any more */
+static int fileio_wait(void)
+{
+	char ev[sizeof(struct inotify_event) + 256];
+	struct inotify_event *e;
+	struct stat st;
+	ssize_t n, i;
+	void *m;
+
+	for (;;) {
+		if (fstat(file_ops.fd, &st) < 0 || (uint64_t)st.st_size < file_ops.total_size)
+			return -1;
+		if ((uint64_t)st.st_size > file_ops.total_size)
+			break;
+		/* unlinking only shows up in the link count while the file is open */
+		if (fmap.gone || st.st_nlink == 0)
+			return -1;
+		n = read(fmap.ifd, ev, sizeof(ev));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		for (i = 0; i < n; i += (ssize_t)(sizeof(struct inotify_event) + e->len)) {
+			e = (struct inotify_event *)(ev + i);
+			if (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+				fmap.gone = 1;
+		}
+	}
+
+	if (fmap.whole) {
+		/* the caller is done with the old window, the mapping may move */
+		if (fmap.map == NULL)
+			m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, file_ops.fd, 0);
+		else
+			m = mremap(fmap.map, fmap.map_len, (size_t)st.st_size, MREMAP_MAYMOVE);
+		if (m == MAP_FAILED)
+			return -1;
+		fmap.map = m;
+		fmap.map_len = (size_t)st.st_size;
+	}
+	file_ops.total_size = (uint64_t)st.st_size;
+	return 0;
+}
+
+static int fileio_read_whole(void **ptr, size_t *len)
+{
+	size_t size = file_ops.block_size;
+
+	if (file_ops.total_size - file_ops.offset < size)
+		size = file_ops.total_size - file_ops.offset;
+	file_ops.ptr = fmap.map + file_ops.offset;
+	file_ops.offset += size;
+	fileio_prefetch(file_ops.offset);
+	*ptr = file_ops.ptr;
+	*len = size;
+	return 0;
+}
+
+static int fileio_read_window(void **ptr, size_t *len)
+{
+	size_t size = file_ops.block_size, delta;
+	uint64_t start;
+
+	if (fmap.map != NULL) {
+		if (munmap(fmap.map, fmap.map_len) < 0) {
 			*ptr = NULL;
 			*len = 0;
 			return -1;
 		}
+		fmap.map = NULL;
 	}
-	file_ops.ptr = NULL;
-	if ((file_ops.ptr = (unsigned char *)mmap(NULL, size, PROT_READ, 
-				MAP_SHARED, file_ops.fd, file_ops.offset)) == (void *)-1)
-	{
+	if (file_ops.total_size - file_ops.offset < size)
+		size = file_ops.total_size - file_ops.offset;
+	/* offset moves in block_size steps unless following, map from its page */
+	start = fileio_page_down(file_ops.offset);
+	delta = (size_t)(file_ops.offset - start);
+	fmap.map = mmap(NULL, size + delta, PROT_READ, MAP_SHARED, file_ops.fd, (off_t)start);
+	if (fmap.map == MAP_FAILED) {
+		fmap.map = NULL;
 		*ptr = NULL;
 		*len = 0;
 		return -1;
 	}
-	if (file_ops.total_size - file_ops.offset < size)
-		size = file_ops.total_size - file_ops.offset;
+	madvise(fmap.map, size + delta, MADV_SEQUENTIAL);
+	fmap.map_len = size + delta;
+	file_ops.ptr = fmap.map + delta;
 	file_ops.offset += size;
+	fileio_prefetch(file_ops.offset);
 	*ptr = file_ops.ptr;
 	*len = size;
 	return 0;
 }
 
+static int fileio_read(void **ptr, size_t *len)
+{
+	/* previous window is consumed, drop its page table entries */
+	if (fmap.whole && file_ops.ptr != NULL) {
+		uint64_t start = fileio_page_down(fmap.prev);
+		madvise(fmap.map + start, file_ops.offset - start, MADV_DONTNEED);
+	}
+	fmap.prev = file_ops.offset;
+	if (unlikely(file_ops.offset >= file_ops.total_size) && (!fmap.follow || fileio_wait() < 0)) {
+		*ptr = NULL;
+		*len = 0;
+		return -1;
+	}
+	if (fmap.whole)
+		return fileio_read_whole(ptr, len);
+	return fileio_read_window(ptr, len);
+}
+
 static int fileio_close(void)
 {
+	if (fmap.map != NULL)
+		munmap(fmap.map, fmap.map_len);
 	if (file_ops.fd >= 0)
 		close(file_ops.fd);
-	munmap(file_ops.ptr, file_ops.block_size);
+	if (fmap.ifd >= 0)
+		close(fmap.ifd);
 
+	fmap.map = NULL;
+	fmap.map_len = 0;
+	fmap.whole = 0;
+	fmap.ifd = -1;
+	file_ops.fd = -1;
 	file_ops.ptr = NULL;
 	file_ops.offset = 0;
 	file_ops.block_size = 0;
 	return 0;
 }
 
-static int fileio_end(void)
+static int64_t fileio_end(void)
 {
-	return (file_ops.total_size - file_ops.offset);
+	/* a recording ends when read() finds it gone */
+	if (fmap.follow)
+		return 1;
+	return (int64_t)(file_ops.total_size - file_ops.offset);
 }
 
 static struct io_ops file_ops = {
 	.type = IO_FILE,
+	.fd = -1,
 	.open = fileio_open,
 	.close = fileio_close,
 	.read = fileio_read,
@@ -23,12 +23,57 @@ struct filter_head {
 
 static struct filter_head pid_filter[MAX_TS_PID_NUM];
 
+uint8_t filter_action[MAX_TS_PID_NUM];
+
+/* rebuild the action of one PID from its filters */
+static void filter_update_action(uint16_t pid)
+{
+	struct list_head *lh = &pid_filter[pid].h;
+	struct filter_slot *ix = NULL;
+	uint8_t act = filter_action[pid] & (FILTER_ACT_PCR | FILTER_ACT_PTS);
+
+	list_for_each(lh, ix, n)
+	{
+		if (ix->t.callback == NULL)
+			continue;
+		if (ix->t.type == FILTER_PES)
+			act |= FILTER_ACT_PES;
+		else
+			act |= FILTER_ACT_SECTION;
+	}
+	/* sections win, the payload is taken one way only */
+	if (act & FILTER_ACT_SECTION)
+		act &= (uint8_t)~FILTER_ACT_PES;
+	if (pid == NULL_PID)
+		act = FILTER_ACT_COUNT;
+	filter_action[pid] = act;
+}
+
+void filter_set_pcr(uint16_t pid, int on)
+{
+	if (on)
+		filter_action[pid] |= FILTER_ACT_PCR;
+	else
+		filter_action[pid] &= (uint8_t)~FILTER_ACT_PCR;
+	filter_update_action(pid);
+}
+
+void filter_set_pts(uint16_t pid, int on)
+{
+	if (on)
+		filter_action[pid] |= FILTER_ACT_PTS;
+	else
+		filter_action[pid] &= (uint8_t)~FILTER_ACT_PTS;
+	filter_update_action(pid);
+}
+
 int filter_init(void)
 {
 	int i = 0;
 	for (i = 0; i < MAX_TS_PID_NUM; i++) {
 		pid_filter[i].filter_num = 0;
 		list_head_init(&pid_filter[i].h);
+		filter_action[i] = FILTER_ACT_COUNT;
 	}
 	return 0;
 }
@@ -57,6 +102,7 @@ int filter_set(filter_t *f, filter_param_t *p, filter_cb func)
 		memcpy(f->para.negete, p->negete, p->depth * sizeof(uint8_t));
 	}
 	f->callback = func;
+	filter_update_action(f->pid);
 	return 0;
 }
 
@@ -69,9 +115,11 @@ int filter_free(filter_t *f)
 	list_for_each_safe(lh, ix, next, n)
 	{
 		if (&ix->t == f) {
+			uint16_t pid = f->pid;
 			list_del(&ix->n);
-			pid_filter[f->pid].filter_num--;
+			pid_filter[pid].filter_num--;
 			free(ix);
+			filter_update_action(pid);
 			break;
 		}
 	}
@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "comm.h"
+#include "frame.h"
+#include "ts.h"
+
+#define ETH_HEADER_LEN (14)
+#define ETHERTYPE_IPV4 (0x0800)
+#define ETHERTYPE_IPV6 (0x86DD)
+#define ETHERTYPE_VLAN (0x8100)
+#define ETHERTYPE_QINQ (0x88A8)
+#define IPPROTO_UDP_NUM (17)
+#define IPV6_HEADER_LEN (40)
+#define UDP_HEADER_LEN (8)
+
+static int frame_ip4_udp_payload(const uint8_t *ip, size_t len, struct flow_key *key, const uint8_t **payload,
+								 size_t *plen)
+{
+	size_t ihl, total;
+	const uint8_t *udp;
+
+	if (unlikely(len < 20))
+		return -1;
+	ihl = (size_t)(ip[0] & 0x0F) * 4;
+	total = TS_READ16(ip + 2);
+	if (ip[9] != IPPROTO_UDP_NUM || ihl < 20 || total > len || total < ihl + UDP_HEADER_LEN)
+		return -1;
+	/* more fragments or a fragment offset */
+	if (TS_READ16(ip + 6) & 0x3FFF)
+		return -1;
+	udp = ip + ihl;
+	key->family = AF_INET;
+	memcpy(&key->saddr, ip + 12, 4);
+	memcpy(&key->daddr, ip + 16, 4);
+	key->sport = TS_READ16(udp);
+	key->dport = TS_READ16(udp + 2);
+	*payload = udp + UDP_HEADER_LEN;
+	*plen = total - ihl - UDP_HEADER_LEN;
+	return 0;
+}
+
+static int frame_ip6_udp_payload(const uint8_t *ip, size_t len, struct flow_key *key, const uint8_t **payload,
+								 size_t *plen)
+{
+	size_t off = IPV6_HEADER_LEN, total;
+	uint8_t next;
+	const uint8_t *udp;
+
+	if (unlikely(len < IPV6_HEADER_LEN))
+		return -1;
+	total = IPV6_HEADER_LEN + TS_READ16(ip + 4);
+	if (total > len)
+		return -1;
+	/* skip hop-by-hop, routing and destination options, fragments are not reassembled */
+	next = ip[6];
+	while (next != IPPROTO_UDP_NUM) {
+		if ((next != 0 && next != 43 && next != 60) || off + 8 > total)
+			return -1;
+		next = ip[off];
+		off += ((size_t)ip[off + 1] + 1) * 8;
+	}
+	if (off + UDP_HEADER_LEN > total)
+		return -1;
+	udp = ip + off;
+	key->family = AF_INET6;
+	key->saddr = 0;
+	key->daddr = 0;
+	memcpy(key->saddr6, ip + 8, 16);
+	memcpy(key->daddr6, ip + 24, 16);
+	key->sport = TS_READ16(udp);
+	key->dport = TS_READ16(udp + 2);
+	*payload = udp + UDP_HEADER_LEN;
+	*plen = total - off - UDP_HEADER_LEN;
+	return 0;
+}
+
+int frame_ip_udp_payload(const uint8_t *ip, size_t len, struct flow_key *key, const uint8_t **payload,
+						 size_t *plen)
+{
+	if (unlikely(len == 0))
+		return -1;
+	if ((ip[0] >> 4) == 4)
+		return frame_ip4_udp_payload(ip, len, key, payload, plen);
+	if ((ip[0] >> 4) == 6)
+		return frame_ip6_udp_payload(ip, len, key, payload, plen);
+	return -1;
+}
+
+int frame_udp_payload(const uint8_t *frame, size_t len, struct flow_key *key, const uint8_t **payload,
+					  size_t *plen)
+{
+	size_t off = ETH_HEADER_LEN;
+	uint16_t type;
+
+	if (unlikely(len < ETH_HEADER_LEN))
+		return -1;
+	type = TS_READ16(frame + 12);
+	while ((type == ETHERTYPE_VLAN || type == ETHERTYPE_QINQ) && off + 4 <= len) {
+		type = TS_READ16(frame + off + 2);
+		off += 4;
+	}
+	if (type == ETHERTYPE_IPV4)
+		return frame_ip4_udp_payload(frame + off, len - off, key, payload, plen);
+	if (type == ETHERTYPE_IPV6)
+		return frame_ip6_udp_payload(frame + off, len - off, key, payload, plen);
+	return -1;
+}
+
+int flow_parse_dst(const char *str, struct flow_key *key)
+{
+	char addr[64];
+	const char *port;
+	size_t n;
+
+	memset(key, 0, sizeof(*key));
+	if (str[0] == '[') {
+		port = strchr(str, ']');
+		if (port == NULL || (size_t)(port - str - 1) >= sizeof(addr))
+			return -1;
+		n = (size_t)(port - str - 1);
+		memcpy(addr, str + 1, n);
+		addr[n] = '\0';
+		port++;
+		if (inet_pton(AF_INET6, addr, key->daddr6) != 1)
+			return -1;
+		key->family = AF_INET6;
+	} else {
+		port = strchr(str, ':');
+		n = port == NULL ? strlen(str) : (size_t)(port - str);
+		if (n >= sizeof(addr))
+			return -1;
+		memcpy(addr, str, n);
+		addr[n] = '\0';
+		if (n > 0) {
+			if (inet_pton(AF_INET, addr, &key->daddr) != 1)
+				return -1;
+			key->family = AF_INET;
+		}
+	}
+	if (port != NULL && *port == ':')
+		key->dport = (uint16_t)atoi(port + 1);
+	return 0;
+}
+
+int flow_dst_match(const struct flow_key *sel, const struct flow_key *key)
+{
+	if (sel->dport != 0 && sel->dport != key->dport)
+		return 0;
+	if (sel->family == 0)
+		return 1;
+	if (sel->family != key->family)
+		return 0;
+	if (sel->family == AF_INET)
+		return sel->daddr == key->daddr;
+	return memcmp(sel->daddr6, key->daddr6, 16) == 0;
+}
+
+struct flow_stat *flow_lookup(struct flow_table *t, const struct flow_key *key)
+{
+	uint32_t h = key->daddr, i;
+
+	if (key->family == AF_INET6)
+		memcpy(&h, key->daddr6 + 12, 4);
+	h = (h ^ ((uint32_t)key->dport * 2654435761u)) % FLOW_TABLE_SIZE;
+	for (i = 0; i < FLOW_TABLE_SIZE; i++) {
+		struct flow_stat *f = &t->flows[(h + i) % FLOW_TABLE_SIZE];
+		if (!f->used) {
+			f->used = 1;
+			f->key = *key;
+			return f;
+		}
+		if (f->key.family == key->family && f->key.dport == key->dport && flow_dst_match(&f->key, key))
+			return f;
+	}
+	t->untracked++;
+	return NULL;
+}
+
+void flow_table_dump(const char *title, struct flow_table *t, const struct flow_key *sel)
+{
+	char addr[INET6_ADDRSTRLEN];
+	int i;
+
+	printf("\n");
+	printf("%s:\n", title);
+	printf("%40s%14s%16s\n", "Flow", "Packets", "Bytes");
+	for (i = 0; i < FLOW_TABLE_SIZE; i++) {
+		struct flow_stat *f = &t->flows[i];
+		if (!f->used)
+			continue;
+		if (f->key.family == AF_INET6)
+			inet_ntop(AF_INET6, f->key.daddr6, addr, sizeof(addr));
+		else
+			inet_ntop(AF_INET, &f->key.daddr, addr, sizeof(addr));
+		printf("%c%32s:%-6u%14" PRIu64 "%16" PRIu64 "\n", (sel != NULL && flow_dst_match(sel, &f->key)) ? '*' : ' ',
+			   addr, f->key.dport, f->pkts, f->bytes);
+	}
+	if (t->untracked)
+		printf("%" PRIu64 " datagrams of untracked flows\n", t->untracked);
+}
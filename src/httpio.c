@@ -0,0 +1,448 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "io.h"
+#include "ts.h"
+
+/*
+ * live TS over plain HTTP/1.1, http://host[:port]/path. the response body
+ * is received into one large buffer and handed out in place, chunked
+ * transfer encoding is undone by handing out the data between the chunk
+ * headers, only a chunk header cut by the end of the buffer is moved.
+ * when the server closes, the body ends or the connection stalls the
+ * request is sent again, the analyzer keeps running across reconnects.
+ */
+
+#define HTTP_DEFAULT_BLOCK (4 * 1024 * 1024)
+#define HTTP_RCVBUF (8 * 1024 * 1024)
+#define HTTP_PORT "80"
+#define HTTP_HEADER_MAX (16 * 1024)
+#define HTTP_TIMEOUT_MS (5000) /* no data for this long, reconnect */
+#define HTTP_RETRY_MS (500) /* first reconnect delay, doubled up to HTTP_RETRY_MAX_MS */
+#define HTTP_RETRY_MAX_MS (8000)
+
+static struct io_ops http_ops;
+
+enum {
+	HTTP_CHUNK_SIZE, /* waiting for a chunk header line */
+	HTTP_CHUNK_DATA,
+	HTTP_CHUNK_END, /* CRLF after the chunk data */
+	HTTP_TRAILER, /* after the last chunk, up to the empty line */
+	HTTP_BODY, /* plain body, with or without a length */
+	HTTP_DONE,
+};
+
+static struct {
+	char host[256];
+	char port[16];
+	char path[2048];
+	uint8_t *buf;
+	size_t size;
+	size_t pos; /* first byte not handed out yet */
+	size_t fill; /* end of received data */
+	int state;
+	int chunked;
+	uint64_t left; /* of the chunk or of a body with a length */
+	int has_length;
+	int retry_ms;
+	uint64_t conn_bytes; /* bytes when the last connection was made */
+	uint64_t connects;
+	uint64_t bytes;
+	uint64_t chunks;
+	uint64_t stalls;
+} hc;
+
+static int http_parse_url(const char *url)
+{
+	const char *host, *end, *colon;
+	size_t n;
+
+	if (strncmp(url, "http://", 7) != 0)
+		return -1;
+	host = url + 7;
+	end = host + strcspn(host, "/");
+	colon = memchr(host, ':', (size_t)(end - host));
+	n = (size_t)((colon != NULL ? colon : end) - host);
+	if (n == 0 || n >= sizeof(hc.host))
+		return -1;
+	memcpy(hc.host, host, n);
+	hc.host[n] = '\0';
+	if (colon != NULL && (size_t)(end - colon - 1) > 0 && (size_t)(end - colon - 1) < sizeof(hc.port)) {
+		memcpy(hc.port, colon + 1, (size_t)(end - colon - 1));
+		hc.port[end - colon - 1] = '\0';
+	} else {
+		snprintf(hc.port, sizeof(hc.port), "%s", HTTP_PORT);
+	}
+	if (strlen(end) >= sizeof(hc.path))
+		return -1;
+	snprintf(hc.path, sizeof(hc.path), "%s", *end ? end : "/");
+	return 0;
+}
+
+/* wait for events on fd, 0 on timeout */
+static int http_poll(int events, int ms)
+{
+	struct pollfd pfd = { .fd = http_ops.fd, .events = (short)events };
+	int n;
+
+	do {
+		n = poll(&pfd, 1, ms);
+	} while (n < 0 && errno == EINTR);
+	return n;
+}
+
+static int http_connect(void)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd = -1, err;
+	socklen_t len = sizeof(err);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(hc.host, hc.port, &hints, &res) != 0)
+		return -1;
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		/* before connect, so the window scale is negotiated for it */
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &(int){ HTTP_RCVBUF }, sizeof(int));
+		http_ops.fd = fd;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 ||
+			(errno == EINPROGRESS && http_poll(POLLOUT, HTTP_TIMEOUT_MS) > 0 &&
+			 getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0))
+			break;
+		close(fd);
+		fd = -1;
+		http_ops.fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int http_send_request(void)
+{
+	char req[2560];
+	int n = snprintf(req, sizeof(req),
+					 "GET %s HTTP/1.1\r\n"
+					 "Host: %s\r\n"
+					 "User-Agent: tsanalyze\r\n"
+					 "Accept: */*\r\n"
+					 "Connection: close\r\n\r\n",
+					 hc.path, hc.host);
+	ssize_t sent;
+	int off = 0;
+
+	if (n < 0 || (size_t)n >= sizeof(req))
+		return -1;
+	while (off < n) {
+		sent = send(http_ops.fd, req + off, (size_t)(n - off), MSG_NOSIGNAL);
+		if (sent < 0 && (errno == EAGAIN || errno == EINTR)) {
+			if (http_poll(POLLOUT, HTTP_TIMEOUT_MS) <= 0)
+				return -1;
+			continue;
+		}
+		if (sent <= 0)
+			return -1;
+		off += (int)sent;
+	}
+	return 0;
+}
+
+/* receive more data behind fill, 0 when the peer closed, -1 on error or stall */
+static ssize_t http_recv(void)
+{
+	ssize_t n;
+
+	for (;;) {
+		n = recv(http_ops.fd, hc.buf + hc.fill, hc.size - hc.fill, 0);
+		if (n >= 0)
+			break;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -1;
+		if (http_poll(POLLIN, HTTP_TIMEOUT_MS) <= 0) {
+			hc.stalls++;
+			return -1;
+		}
+	}
+	hc.fill += (size_t)n;
+	return n;
+}
+
+/* move what is left to the front so a partial line can be completed */
+static void http_compact(void)
+{
+	if (hc.pos == 0)
+		return;
+	memmove(hc.buf, hc.buf + hc.pos, hc.fill - hc.pos);
+	hc.fill -= hc.pos;
+	hc.pos = 0;
+}
+
+/* a CRLF terminated line at pos, NULL until it is complete */
+static char *http_line(size_t *len)
+{
+	uint8_t *p = memchr(hc.buf + hc.pos, '\n', hc.fill - hc.pos);
+	char *line = (char *)hc.buf + hc.pos;
+
+	if (p == NULL)
+		return NULL;
+	*len = (size_t)(p - (hc.buf + hc.pos)) + 1;
+	hc.pos += *len;
+	return line;
+}
+
+static int http_response(void)
+{
+	char *line, *v;
+	size_t len;
+	int status = 0, first = 1, chunked = 0;
+
+	hc.pos = hc.fill = 0;
+	hc.has_length = 0;
+	for (;;) {
+		line = http_line(&len);
+		if (line == NULL) {
+			if (hc.fill >= HTTP_HEADER_MAX || http_recv() <= 0)
+				return -1;
+			continue;
+		}
+		line[len - 1] = '\0';
+		if (len >= 2 && line[len - 2] == '\r')
+			line[len - 2] = '\0';
+		if (first) {
+			first = 0;
+			if (sscanf(line, "HTTP/%*d.%*d %d", &status) != 1)
+				return -1;
+			continue;
+		}
+		if (line[0] == '\0')
+			break;
+		v = strchr(line, ':');
+		if (v == NULL)
+			continue;
+		*v++ = '\0';
+		v += strspn(v, " \t");
+		if (strcasecmp(line, "Transfer-Encoding") == 0 && strcasestr(v, "chunked") != NULL) {
+			chunked = 1;
+		} else if (strcasecmp(line, "Content-Length") == 0) {
+			hc.left = strtoull(v, NULL, 10);
+			hc.has_length = 1;
+		}
+	}
+	if (status != 200) {
+		printf("http: %s:%s%s answered %d\n", hc.host, hc.port, hc.path, status);
+		return -1;
+	}
+	/* kept for the dump, only a good answer changes it */
+	hc.chunked = chunked;
+	if (hc.chunked)
+		hc.has_length = 0;
+	hc.state = hc.chunked ? HTTP_CHUNK_SIZE : HTTP_BODY;
+	return 0;
+}
+
+static void http_disconnect(void)
+{
+	if (http_ops.fd >= 0)
+		close(http_ops.fd);
+	http_ops.fd = -1;
+}
+
+static int http_request(void)
+{
+	if (http_connect() < 0 || http_send_request() < 0 || http_response() < 0) {
+		http_disconnect();
+		return -1;
+	}
+	hc.connects++;
+	hc.conn_bytes = hc.bytes;
+	return 0;
+}
+
+static void http_backoff(void)
+{
+	struct timespec ts;
+
+	ts.tv_sec = hc.retry_ms / 1000;
+	ts.tv_nsec = (long)(hc.retry_ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+	if (hc.retry_ms < HTTP_RETRY_MAX_MS)
+		hc.retry_ms *= 2;
+}
+
+/* start over until the server answers again, right away if the last answer carried data */
+static void http_reconnect(void)
+{
+	http_disconnect();
+	if (hc.bytes > hc.conn_bytes)
+		hc.retry_ms = HTTP_RETRY_MS;
+	else
+		http_backoff();
+	while (http_request() < 0)
+		http_backoff();
+}
+
+static int http_close(void);
+
+static int http_open(const char *url)
+{
+	struct tsa_config *tsaconf = get_config();
+
+	if (url == NULL)
+		return -1;
+	memset(&hc, 0, sizeof(hc));
+	if (http_parse_url(url) < 0) {
+		printf("http: bad url %s\n", url);
+		return -1;
+	}
+	http_ops.block_size = HTTP_DEFAULT_BLOCK;
+	if (tsaconf->mem)
+		http_ops.block_size = (size_t)tsaconf->mem * 1024 * 1024;
+	hc.size = http_ops.block_size;
+	hc.buf = malloc(hc.size);
+	if (hc.buf == NULL)
+		return -1;
+	hc.retry_ms = HTTP_RETRY_MS;
+	http_ops.offset = 0;
+	/* a server that is not there at all is an error, later outages are waited out */
+	if (http_request() < 0) {
+		http_close();
+		return -1;
+	}
+	return 0;
+}
+
+/* step over chunk framing at pos, 1 once body data is at pos, 0 if more input is needed */
+static int http_dechunk(void)
+{
+	char *line, *end;
+	size_t len;
+
+	for (;;) {
+		switch (hc.state) {
+		case HTTP_CHUNK_SIZE:
+			line = http_line(&len);
+			if (line == NULL)
+				return 0;
+			hc.left = strtoull(line, &end, 16);
+			if (end == line) {
+				hc.state = HTTP_DONE;
+				return -1;
+			}
+			hc.chunks++;
+			hc.state = hc.left ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+			break;
+		case HTTP_CHUNK_END:
+			line = http_line(&len);
+			if (line == NULL)
+				return 0;
+			hc.state = HTTP_CHUNK_SIZE;
+			break;
+		case HTTP_TRAILER:
+			line = http_line(&len);
+			if (line == NULL)
+				return 0;
+			if (len <= 2)
+				hc.state = HTTP_DONE;
+			break;
+		case HTTP_DONE:
+			return -1;
+		default:
+			return 1;
+		}
+	}
+}
+
+static int http_read(void **ptr, size_t *len)
+{
+	size_t n;
+	int ret;
+
+	for (;;) {
+		if (hc.state == HTTP_DONE || (hc.state == HTTP_BODY && hc.has_length && hc.left == 0)) {
+			http_reconnect();
+			continue;
+		}
+		ret = hc.state == HTTP_BODY ? 1 : http_dechunk();
+		if (ret < 0)
+			continue;
+		if (ret > 0 && hc.pos < hc.fill)
+			break;
+		/* everything handed out or a header cut short, make room behind it */
+		if (hc.pos == hc.fill)
+			hc.pos = hc.fill = 0;
+		else if (hc.fill == hc.size)
+			http_compact();
+		if (http_recv() <= 0)
+			hc.state = HTTP_DONE;
+	}
+
+	n = hc.fill - hc.pos;
+	if ((hc.state == HTTP_CHUNK_DATA || hc.has_length) && n > hc.left)
+		n = (size_t)hc.left;
+	if (hc.state == HTTP_CHUNK_DATA || hc.has_length)
+		hc.left -= n;
+	if (hc.state == HTTP_CHUNK_DATA && hc.left == 0)
+		hc.state = HTTP_CHUNK_END;
+
+	http_ops.ptr = hc.buf + hc.pos;
+	hc.pos += n;
+	hc.bytes += n;
+	http_ops.offset += n;
+	*ptr = http_ops.ptr;
+	*len = n;
+	return 0;
+}
+
+static int http_close(void)
+{
+	http_disconnect();
+	free(hc.buf);
+	hc.buf = NULL;
+	http_ops.ptr = NULL;
+	return 0;
+}
+
+static int64_t http_end(void)
+{
+	return 1;
+}
+
+static void http_dump(void)
+{
+	printf("\n");
+	printf("HTTP input:\n");
+	printf("%12s%12s%16s%12s%12s\n", "Connects", "Stalls", "Bytes", "Chunks", "Chunked");
+	printf("%12" PRIu64 "%12" PRIu64 "%16" PRIu64 "%12" PRIu64 "%12s\n", hc.connects, hc.stalls, hc.bytes,
+		   hc.chunks, hc.chunked ? "yes" : "no");
+}
+
+static struct io_ops http_ops = {
+	.type = IO_HTTP,
+	.fd = -1,
+	.open = http_open,
+	.read = http_read,
+	.close = http_close,
+	.end = http_end,
+	.dump = http_dump,
+};
+
+REGISTER_IO_OPS(http, &http_ops);
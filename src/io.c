@@ -3,7 +3,7 @@
 
 #include "io.h"
 
-#define MAX_IO_METHOD (10)
+#define MAX_IO_METHOD (16)
 
 static struct io_ops *ioops[MAX_IO_METHOD];
 
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
@@ -9,37 +11,133 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include "filter.h"
+#include "io.h"
 #include "table.h"
 #include "ts.h"
 
+#define MAX_WORKERS (64)
+
+static pid_t workers[MAX_WORKERS];
+static int worker_num;
+static int is_worker;
+
 int prog_parse_args(int argc, char **argv);
 
 void dump_result(int sig)
 {
+	struct io_ops *ops = lookup_io_ops(get_config()->type);
+
+	if (is_worker)
+		printf("\nstream %s\n", get_config()->name);
 	dump_tables();
 	dump_ts_info();
+	if (ops != NULL && ops->dump != NULL)
+		ops->dump();
 	
 	free_tables();
 	uninit_pid_processor();
 	exit(sig);
 }
 
+static void stop_workers(int sig)
+{
+	/* one after the other so their reports do not interleave */
+	for (int i = 0; i < worker_num; i++) {
+		kill(workers[i], SIGINT);
+		waitpid(workers[i], NULL, 0);
+	}
+	exit(sig);
+}
+
+/*
+ * a comma separated list of urls is watched by one worker process per url,
+ * each worker runs its own analyzer on its own socket.
+ * return 1 in the workers, 0 in the parent once all workers are gone
+ */
+static int fork_workers(void)
+{
+	struct tsa_config *tsaconf = get_config();
+	char *names = strdup(tsaconf->name);
+	char *tok = names, *next;
+	const char *scheme = "udp";
+	int num = 1;
+	pid_t pid;
+
+	for (next = names; (next = strchr(next, ',')) != NULL; next++)
+		num++;
+	if (num > MAX_WORKERS) {
+		printf("at most %d streams, %d given\n", MAX_WORKERS, num);
+		exit(1);
+	}
+
+	if (tsaconf->type == IO_RTP)
+		scheme = "rtp";
+	else if (tsaconf->type == IO_TPACKET)
+		scheme = "tpacket";
+
+	signal(SIGINT, stop_workers);
+	while (tok != NULL) {
+		next = strchr(tok, ',');
+		if (next != NULL)
+			*next++ = '\0';
+		pid = fork();
+		if (pid == 0) {
+			/* ctrl-c goes to the parent only, it stops workers in turn */
+			setpgid(0, 0);
+#ifdef __linux__
+			prctl(PR_SET_PDEATHSIG, SIGINT);
+#endif
+			if (strstr(tok, "://") == NULL)
+				snprintf(tsaconf->name, sizeof(tsaconf->name), "%s://%s", scheme, tok);
+			else
+				snprintf(tsaconf->name, sizeof(tsaconf->name), "%s", tok);
+			free(names);
+			is_worker = 1;
+			return 1;
+		}
+		if (pid < 0) {
+			/* a stream left out would go unnoticed, give up on all of them */
+			printf("cannot start a worker for %s: %s\n", tok, strerror(errno));
+			free(names);
+			stop_workers(1);
+		}
+		workers[worker_num++] = pid;
+		tok = next;
+	}
+	free(names);
+
+	for (int i = 0; i < worker_num; i++)
+		waitpid(workers[i], NULL, 0);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
 	ret = prog_parse_args(argc, argv);
 	if (ret < 0)
 		return -1;
+
+	if ((get_config()->type == IO_UDP || get_config()->type == IO_RTP || get_config()->type == IO_TPACKET) &&
+		strchr(get_config()->name, ',') != NULL) {
+		if (fork_workers() == 0)
+			return 0;
+	}
 	signal(SIGINT, dump_result);
 
 	init_pid_processor();
 
-	ts_process();
+	/* what was analyzed is still reported, the exit status tells it was not all */
+	ret = ts_process() < 0 ? 1 : 0;
 
-	dump_result(0);
+	dump_result(ret);
 
 	return 0;
 }
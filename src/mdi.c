@@ -0,0 +1,45 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mdi.h"
+
+void mdi_init(struct mdi *m, uint32_t interval_ms)
+{
+	memset(m, 0, sizeof(*m));
+	if (interval_ms == 0)
+		interval_ms = MDI_DEFAULT_INTERVAL;
+	m->interval = (uint64_t)interval_ms * 1000000;
+}
+
+void mdi_interval_end(struct mdi *m, uint64_t now)
+{
+	uint64_t span = now - m->start;
+
+	if (m->rate > 0) {
+		m->df = (m->vb_max - m->vb_min) / m->rate / 1e6;
+		if (m->df > m->df_max)
+			m->df_max = m->df;
+		m->df_sum += m->df;
+		m->intervals++;
+	}
+	m->mlr = (double)m->lost * 1e9 / (double)span;
+	if (m->mlr > m->mlr_max)
+		m->mlr_max = m->mlr;
+	m->rate = (double)m->bytes / (double)span;
+	m->start = now;
+	m->bytes = 0;
+	m->lost = 0;
+	m->vb_min = 0;
+	m->vb_max = 0;
+}
+
+void mdi_dump(const char *name, struct mdi *m)
+{
+	printf("\n");
+	printf("MDI %s (%" PRIu64 " ms intervals):\n", name, m->interval / 1000000);
+	printf("%12s%12s%12s%14s%14s%12s%14s\n", "Intervals", "DF(ms)", "DF max", "DF avg", "MLR(pkt/s)", "MLR max",
+		   "Lost pkts");
+	printf("%12" PRIu64 "%12.3f%12.3f%14.3f%14.1f%12.1f%14" PRIu64 "\n", m->intervals, m->df, m->df_max,
+		   m->intervals ? m->df_sum / (double)m->intervals : 0.0, m->mlr, m->mlr_max, m->lost_total);
+}
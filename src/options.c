@@ -6,8 +6,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "io.h"
 #include "ts.h"
 #include "result.h"
 
@@ -20,6 +22,8 @@
 #define OPT_TABLE "table"
 #define OPT_PID "pid"
 #define OPT_OUT "output"
+#define OPT_INTERVAL "interval"
+#define OPT_FOLLOW "follow"
 
 enum {
 	/* long options mapped to a short option */
@@ -32,6 +36,8 @@ enum {
 	OPT_TABLE_NUM = 's',
 	OPT_PID_NUM = 'p',
 	OPT_OUT_NUM = 'o',
+	OPT_INTERVAL_NUM = 'i',
+	OPT_FOLLOW_NUM = 'F',
 };
 
 static struct tsa_config tsaconf = {
@@ -43,15 +49,32 @@ struct tsa_config *get_config(void)
 	return &tsaconf;
 }
 
+/* 0 for a regular file, 1 for a pipe, FIFO or device that can only be streamed, 2 for a compressed file */
 int check_filepath_valid(char *filename)
 {
+	struct stat st;
 	if (filename == NULL)
 		return -1;
-	int fd = open(filename, O_RDONLY);
-	if (fd < 0)
+	if (strcmp(filename, "-") == 0 || strncmp(filename, "pipe:", 5) == 0)
+		return 1;
+	/* stat, opening a FIFO would wait for its writer */
+	if (stat(filename, &st) < 0 || access(filename, R_OK) < 0)
 		return -1;
-	close(fd);
-	return 0;
+	if (!S_ISREG(st.st_mode))
+		return 1;
+	switch (zip_probe(filename)) {
+	case ZIP_GZIP:
+		return 2;
+	case ZIP_ZSTD:
+#ifdef HAVE_ZSTD
+		return 2;
+#else
+		printf("zstd support was not built in\n");
+		return -1;
+#endif
+	default:
+		return 0;
+	}
 }
 
 uint8_t parse_table(const char *table)
@@ -71,9 +94,9 @@ uint8_t parse_table(const char *table)
 
 uint8_t parse_format_type(const char *format)
 {
-#define FORMAT_NUM (2)
+#define FORMAT_NUM (12)
 	uint8_t i = 0;
-	const char *formats[FORMAT_NUM] = { "file", "udp" };
+	const char *formats[FORMAT_NUM] = { "file", "udp", "uring", "direct", "rtp", "tpacket", "xdp", "pcap", "pipe", "shm", "hitless", "http" };
 	for (i = 0; i < FORMAT_NUM; i++) {
 		if (strcmp(formats[i], format) == 0) {
 			return i;
@@ -103,6 +126,22 @@ void parse_selected_pids(const char *format)
 	tsaconf.pids[pid] = 1;
 }
 
+void parse_memory_size(const char *size)
+{
+	int mb = atoi(size);
+	if (mb <= 0 || mb > 4096)
+		return;
+	tsaconf.mem = mb;
+}
+
+void parse_interval(const char *ms)
+{
+	int v = atoi(ms);
+	if (v <= 0 || v > 3600000)
+		return;
+	tsaconf.mdi_interval = v;
+}
+
 void prog_usage(FILE *fp, const char *pro_name)
 {
 	if (fp == NULL)
@@ -110,11 +149,13 @@ void prog_usage(FILE *fp, const char *pro_name)
 	fprintf(fp, "Usage: %s [optins]... <file>\n", pro_name);
 	fprintf(fp, "  Display infomations about mpeg ts.\n\n");
 	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_HELP_NUM, ", --" OPT_HELP, "Show this help");
-	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_FORMAT_NUM, ", --" OPT_FORMAT, "Select input format [udp][file]");
+	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_FORMAT_NUM, ", --" OPT_FORMAT, "Select input format [udp][file][uring][direct][rtp][tpacket][xdp][pcap][pipe][shm][hitless][http]");
 	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_BRIEF_LIST_NUM, ", --" OPT_BRIEF_LIST, "Show all infos in brief");
 	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_DETAIL_LIST_NUM, ", --" OPT_DETAIL_LIST, "Show all ts infos");
 	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_VERSION_NUM, ", --" OPT_VERSION, "Show version");
-	/*fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_MEMORY_NUM, ", --" OPT_MEMORY, "memory to use");*/
+	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_MEMORY_NUM, ", --" OPT_MEMORY, "Input block size in MB");
+	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_INTERVAL_NUM, ", --" OPT_INTERVAL, "MDI interval in ms for udp and rtp");
+	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_FOLLOW_NUM, ", --" OPT_FOLLOW, "Follow a file that is still being recorded");
 	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_TABLE_NUM, ", --" OPT_TABLE, "Show table [pat][cat][pmt][tsdt][nit][sdt][bat][tdt]");
 	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_PID_NUM, ", --" OPT_PID, "Show select pid only");
 	fprintf(fp, "%13s%c%s\t%s\n", "  -", OPT_OUT_NUM, ", --" OPT_OUT, "Save output to [stdout][txt][json]");
@@ -123,14 +164,16 @@ void prog_usage(FILE *fp, const char *pro_name)
 
 int prog_parse_args(int argc, char **argv)
 {
-	int opt, option_index;
+	int opt, option_index, ret;
 	const char *prgname = argv[0];
 
 	// make a copy of the options
 	const char short_options[] = "b"  /* brief */
 								 "d"  /* details */
+								 "F"  /* follow */
 								 "h"  /* help */
 								 "m:" /* memory size */
+								 "i:" /* mdi interval */
 								 "v"  /* version */
 								 "s:" /* tables */
 								 "f:" /* format */
@@ -142,6 +185,8 @@ int prog_parse_args(int argc, char **argv)
 										   { OPT_VERSION, 0, NULL, OPT_VERSION_NUM },
 										   { OPT_HELP, 0, NULL, OPT_HELP_NUM },
 										   { OPT_MEMORY, 1, NULL, OPT_MEMORY_NUM },
+										   { OPT_INTERVAL, 1, NULL, OPT_INTERVAL_NUM },
+										   { OPT_FOLLOW, 0, NULL, OPT_FOLLOW_NUM },
 										   { OPT_TABLE, 0, NULL, OPT_TABLE_NUM },
 										   { OPT_FORMAT, 1, NULL, OPT_FORMAT_NUM },
 										   { OPT_PID, 0, NULL, OPT_PID_NUM },
@@ -184,22 +229,37 @@ int prog_parse_args(int argc, char **argv)
 		case 'p':
 			parse_selected_pids(optarg);
 			break;
+		case 'm':
+			parse_memory_size(optarg);
+			break;
+		case 'i':
+			parse_interval(optarg);
+			break;
+		case 'F':
+			tsaconf.follow = 1;
+			break;
 		default:
 			break;
 		}
 	}
 
-	snprintf(tsaconf.name, 256, "%s", argv[argc - 1]);
+	snprintf(tsaconf.name, sizeof(tsaconf.name), "%s", argv[argc - 1]);
 
 	if (tsaconf.type == UINT8_MAX) {
 		printf("file type not specified\n");
 		return -EINVAL;
 	}
-	if (tsaconf.type == 0) {
-		if (check_filepath_valid(argv[argc - 1]) < 0) {
+	if (tsaconf.type == IO_FILE || tsaconf.type == IO_URING || tsaconf.type == IO_DIRECT) {
+		ret = check_filepath_valid(argv[argc - 1]);
+		if (ret < 0) {
 			printf("no such file or invalid filepath\n");
 			return -ENOENT;
 		}
+		/* nothing to map or seek in, stream it */
+		if (ret == 1)
+			tsaconf.type = IO_PIPE;
+		else if (ret == 2)
+			tsaconf.type = IO_ZIP;
 	}
 
 	if (tsaconf.output == UINT8_MAX) {
@@ -207,7 +267,7 @@ int prog_parse_args(int argc, char **argv)
 		return -EINVAL;
 	}
 	res_settype(tsaconf.output);
-	res_open(argv[argc - 1]);
+	res_open(strcmp(argv[argc - 1], "-") == 0 ? "stdin" : argv[argc - 1]);
 
 	return 0;
 }
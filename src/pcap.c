@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "frame.h"
+#include "io.h"
+#include "rtp.h"
+#include "ts.h"
+
+/*
+ * offline replay of pcap and pcapng captures. the file is mapped once and
+ * walked record by record, UDP payloads of the selected flow are handed out
+ * straight from the mapping with RTP headers stripped, and the capture time
+ * of each one is kept in stamp.
+ *
+ * pcap://capture.pcapng[?dst=addr:port], addr may be [v6addr]. without a
+ * flow the first one carrying TS is taken
+ */
+
+#define PCAP_MAGIC_US (0xA1B2C3D4)
+#define PCAP_MAGIC_NS (0xA1B23C4D)
+#define PCAP_HEADER_LEN (24)
+#define PCAP_RECORD_LEN (16)
+#define PCAPNG_SHB (0x0A0D0D0A)
+#define PCAPNG_IDB (0x00000001)
+#define PCAPNG_PB (0x00000002)
+#define PCAPNG_SPB (0x00000003)
+#define PCAPNG_EPB (0x00000006)
+#define PCAPNG_BOM (0x1A2B3C4D)
+#define PCAPNG_OPT_TSRESOL (9)
+#define PCAP_MAX_IF (32)
+#define PCAP_RELEASE (8 * 1024 * 1024)
+
+#define LINKTYPE_NULL (0)
+#define LINKTYPE_ETHERNET (1)
+#define LINKTYPE_RAW (101)
+#define LINKTYPE_LOOP (108)
+#define LINKTYPE_LINUX_SLL (113)
+#define LINKTYPE_IPV4 (228)
+#define LINKTYPE_IPV6 (229)
+#define LINKTYPE_LINUX_SLL2 (276)
+
+static struct io_ops pcap_ops;
+
+struct pcap_if {
+	int linktype;
+	int pow2; /* timestamp units are 2^-exp seconds instead of 10^-exp */
+	uint8_t exp;
+};
+
+static struct {
+	uint8_t *map;
+	size_t len;
+	size_t off; /* next record or block */
+	size_t released; /* pages before this were dropped */
+	int ng;
+	int swap;
+	struct pcap_if ifs[PCAP_MAX_IF];
+	int if_num;
+	struct flow_key want; /* flow asked for, may hold wildcards */
+	struct flow_key sel; /* flow being analyzed */
+	int locked;
+	struct flow_table flows;
+	uint64_t records;
+	uint64_t datagrams;
+	uint64_t bytes;
+	uint64_t first;
+	uint64_t last;
+} pc;
+
+static inline uint32_t pcap_rd32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return pc.swap ? __builtin_bswap32(v) : v;
+}
+
+static inline uint16_t pcap_rd16(const uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, 2);
+	return pc.swap ? __builtin_bswap16(v) : v;
+}
+
+static uint64_t pcap_ns(const struct pcap_if *i, uint64_t ts)
+{
+	static const uint64_t pow10[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+									  10000000ULL, 100000000ULL, 1000000000ULL };
+	uint8_t e = i->exp;
+
+	if (i->pow2) {
+		/* keep the fraction product inside 64 bits */
+		if (e > 32) {
+			ts >>= e - 32;
+			e = 32;
+		}
+		return (ts >> e) * 1000000000ULL + (((ts & ((1ULL << e) - 1)) * 1000000000ULL) >> e);
+	}
+	if (e <= 9)
+		return ts * pow10[9 - e];
+	if (e - 9 <= 9)
+		return ts / pow10[e - 9];
+	return 0;
+}
+
+static void pcap_idb(const uint8_t *b, uint32_t blen)
+{
+	struct pcap_if *i;
+	uint32_t off = 16;
+	uint16_t code, olen;
+
+	if (pc.if_num >= PCAP_MAX_IF || blen < 20)
+		return;
+	i = &pc.ifs[pc.if_num++];
+	i->linktype = pcap_rd16(b + 8);
+	i->pow2 = 0;
+	i->exp = 6;
+	while (off + 4 <= blen - 4) {
+		code = pcap_rd16(b + off);
+		olen = pcap_rd16(b + off + 2);
+		if (code == 0 || off + 4 + olen > blen - 4)
+			break;
+		if (code == PCAPNG_OPT_TSRESOL && olen >= 1) {
+			i->pow2 = (b[off + 4] & 0x80) != 0;
+			i->exp = b[off + 4] & 0x7F;
+		}
+		off += 4 + ((olen + 3u) & ~3u);
+	}
+}
+
+/* next packet of a pcapng file, -1 at the end */
+static int pcapng_next(const uint8_t **data, size_t *caplen, int *linktype, uint64_t *stamp)
+{
+	const uint8_t *b;
+	uint32_t type, blen, bom, ifid;
+	uint64_t ts;
+
+	while (pc.off + 12 <= pc.len) {
+		b = pc.map + pc.off;
+		memcpy(&type, b, 4);
+		if (type == PCAPNG_SHB) {
+			/* every section carries its own byte order and interfaces */
+			memcpy(&bom, b + 8, 4);
+			if (bom == PCAPNG_BOM)
+				pc.swap = 0;
+			else if (bom == __builtin_bswap32(PCAPNG_BOM))
+				pc.swap = 1;
+			else
+				return -1;
+			pc.if_num = 0;
+		}
+		type = pcap_rd32(b);
+		blen = pcap_rd32(b + 4);
+		if (blen < 12 || blen > pc.len - pc.off)
+			return -1;
+		pc.off += (blen + 3u) & ~3u;
+
+		if (type == PCAPNG_IDB) {
+			pcap_idb(b, blen);
+		} else if ((type == PCAPNG_EPB || type == PCAPNG_PB) && blen >= 32) {
+			ifid = type == PCAPNG_EPB ? pcap_rd32(b + 8) : pcap_rd16(b + 8);
+			if (ifid >= (uint32_t)pc.if_num)
+				continue;
+			*caplen = pcap_rd32(b + 20);
+			if (*caplen > blen - 32)
+				continue;
+			ts = ((uint64_t)pcap_rd32(b + 12) << 32) | pcap_rd32(b + 16);
+			*stamp = pcap_ns(&pc.ifs[ifid], ts);
+			*linktype = pc.ifs[ifid].linktype;
+			*data = b + 28;
+			return 0;
+		} else if (type == PCAPNG_SPB && blen >= 16 && pc.if_num > 0) {
+			/* simple packets carry no timestamp */
+			*caplen = pcap_rd32(b + 8);
+			if (*caplen > blen - 16)
+				*caplen = blen - 16;
+			*stamp = 0;
+			*linktype = pc.ifs[0].linktype;
+			*data = b + 12;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* next packet of a classic pcap file, -1 at the end */
+static int pcap_next(const uint8_t **data, size_t *caplen, int *linktype, uint64_t *stamp)
+{
+	const uint8_t *r;
+	uint32_t incl;
+
+	if (pc.ng)
+		return pcapng_next(data, caplen, linktype, stamp);
+	if (pc.off + PCAP_RECORD_LEN > pc.len)
+		return -1;
+	r = pc.map + pc.off;
+	incl = pcap_rd32(r + 8);
+	if (incl > pc.len - pc.off - PCAP_RECORD_LEN)
+		return -1;
+	pc.off += PCAP_RECORD_LEN + incl;
+	*stamp = (uint64_t)pcap_rd32(r) * 1000000000ULL + pcap_ns(&pc.ifs[0], pcap_rd32(r + 4));
+	*linktype = pc.ifs[0].linktype;
+	*caplen = incl;
+	*data = r + PCAP_RECORD_LEN;
+	return 0;
+}
+
+static int pcap_udp_payload(int linktype, const uint8_t *d, size_t len, struct flow_key *key,
+							const uint8_t **payload, size_t *plen)
+{
+	switch (linktype) {
+	case LINKTYPE_ETHERNET:
+		return frame_udp_payload(d, len, key, payload, plen);
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		return frame_ip_udp_payload(d, len, key, payload, plen);
+	case LINKTYPE_NULL:
+	case LINKTYPE_LOOP:
+		/* address family in capture host order, the IP version tells enough */
+		if (len < 4)
+			return -1;
+		return frame_ip_udp_payload(d + 4, len - 4, key, payload, plen);
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return -1;
+		return frame_ip_udp_payload(d + 16, len - 16, key, payload, plen);
+	case LINKTYPE_LINUX_SLL2:
+		if (len < 20)
+			return -1;
+		return frame_ip_udp_payload(d + 20, len - 20, key, payload, plen);
+	default:
+		return -1;
+	}
+}
+
+static int pcap_parse_header(void)
+{
+	uint32_t magic;
+
+	if (pc.len < PCAP_HEADER_LEN)
+		return -1;
+	memcpy(&magic, pc.map, 4);
+	if (magic == PCAPNG_SHB) {
+		pc.ng = 1;
+		return 0;
+	}
+	pc.swap = magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS);
+	magic = pcap_rd32(pc.map);
+	if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS)
+		return -1;
+	pc.if_num = 1;
+	pc.ifs[0].linktype = (int)(pcap_rd32(pc.map + 20) & 0xFFFF);
+	pc.ifs[0].pow2 = 0;
+	pc.ifs[0].exp = magic == PCAP_MAGIC_NS ? 9 : 6;
+	pc.off = PCAP_HEADER_LEN;
+	return 0;
+}
+
+static int pcap_open(const char *urlpath)
+{
+	char path[4096], *opt;
+	struct stat st;
+	int fd;
+
+	memset(&pc, 0, sizeof(pc));
+	if (urlpath == NULL)
+		return -1;
+	if (strncmp(urlpath, "pcap://", 7) == 0)
+		urlpath += 7;
+	snprintf(path, sizeof(path), "%s", urlpath);
+	opt = strstr(path, "?dst=");
+	if (opt != NULL) {
+		*opt = '\0';
+		if (flow_parse_dst(opt + 5, &pc.want) < 0)
+			return -1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+		close(fd);
+		return -1;
+	}
+	pc.len = (size_t)st.st_size;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	pc.map = mmap(NULL, pc.len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pc.map == MAP_FAILED) {
+		pc.map = NULL;
+		return -1;
+	}
+	madvise(pc.map, pc.len, MADV_SEQUENTIAL);
+	if (pcap_parse_header() < 0) {
+		munmap(pc.map, pc.len);
+		pc.map = NULL;
+		return -1;
+	}
+	pcap_ops.total_size = pc.len;
+	pcap_ops.offset = pc.off;
+	pcap_ops.block_size = UINT16_MAX;
+	pcap_ops.stamp = 0;
+	return 0;
+}
+
+/* records before off are consumed, drop their pages once enough piled up */
+static void pcap_release(size_t off)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t end = off / page * page;
+
+	if (end - pc.released < PCAP_RELEASE)
+		return;
+	madvise(pc.map + pc.released, end - pc.released, MADV_DONTNEED);
+	pc.released = end;
+}
+
+static int pcap_read(void **ptr, size_t *len)
+{
+	struct flow_key key;
+	struct flow_stat *f;
+	const uint8_t *data, *payload;
+	size_t caplen, plen;
+	uint64_t stamp;
+	uint16_t seq, off, rlen;
+	int linktype;
+
+	for (;;) {
+		pcap_release(pc.off);
+		if (pcap_next(&data, &caplen, &linktype, &stamp) < 0) {
+			pcap_ops.offset = pc.len;
+			*ptr = NULL;
+			*len = 0;
+			return -1;
+		}
+		pc.records++;
+		if (pcap_udp_payload(linktype, data, caplen, &key, &payload, &plen) < 0 || plen == 0)
+			continue;
+		f = flow_lookup(&pc.flows, &key);
+		if (f != NULL) {
+			f->pkts++;
+			f->bytes += plen;
+		}
+		if (unlikely(!pc.locked)) {
+			if (!flow_dst_match(&pc.want, &key) ||
+				(payload[0] != TS_SYNC_BYTE && rtp_parse_header(payload, plen, &seq, &off, &rlen) < 0))
+				continue;
+			pc.sel = key;
+			pc.locked = 1;
+		} else if (!flow_dst_match(&pc.sel, &key)) {
+			continue;
+		}
+		if (payload[0] != TS_SYNC_BYTE && rtp_parse_header(payload, plen, &seq, &off, &rlen) == 0) {
+			payload += off;
+			plen = rlen;
+		}
+		if (plen == 0)
+			continue;
+		if (pc.datagrams++ == 0)
+			pc.first = stamp;
+		pc.last = stamp;
+		pc.bytes += plen;
+		pcap_ops.stamp = stamp;
+		pcap_ops.offset = pc.off;
+		*ptr = (void *)payload;
+		*len = plen;
+		return 0;
+	}
+}
+
+static int pcap_close(void)
+{
+	if (pc.map != NULL)
+		munmap(pc.map, pc.len);
+	pc.map = NULL;
+	pcap_ops.offset = 0;
+	return 0;
+}
+
+static int64_t pcap_end(void)
+{
+	return (int64_t)(pc.len - pc.off);
+}
+
+static void pcap_dump(void)
+{
+	uint64_t span = pc.last - pc.first;
+
+	printf("\n");
+	printf("Capture replay:\n");
+	printf("%12s%12s%16s%16s%14s\n", "Records", "Datagrams", "TS bytes", "Duration(ms)", "Bitrate(bps)");
+	printf("%12" PRIu64 "%12" PRIu64 "%16" PRIu64 "%16" PRIu64 "%14" PRIu64 "\n", pc.records, pc.datagrams, pc.bytes,
+		   span / 1000000, span ? (uint64_t)((double)pc.bytes * 8 * 1e9 / (double)span) : 0);
+	flow_table_dump("Capture flows", &pc.flows, pc.locked ? &pc.sel : NULL);
+}
+
+static struct io_ops pcap_ops = {
+	.type = IO_PCAP,
+	.fd = -1,
+	.open = pcap_open,
+	.read = pcap_read,
+	.close = pcap_close,
+	.end = pcap_end,
+	.dump = pcap_dump,
+};
+
+REGISTER_IO_OPS(pcap, &pcap_ops);
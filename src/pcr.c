@@ -0,0 +1,307 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pcr.h"
+#include "result.h"
+#include "ts.h"
+
+#define PCR_PIDS (32)
+#define PCR_HIST (20) /* |error| below 128 ns, then doubling up to 2^25 ns and above */
+#define PCR_WARMUP (25) /* PCRs on a line before its errors count */
+#define PCR_BLOCK (10000000000ULL) /* ns of arrival time per PCR_FO step of PCR_DR */
+#define PCR_GAP (SYS_CLK / 10) /* further apart is a new time base */
+
+/* least squares line through (x, y), Welford's running means and co-moments */
+struct pcr_fit {
+	uint64_t n;
+	double mx;
+	double my;
+	double m2x;
+	double cxy;
+};
+
+/* distances from a line in ns */
+struct pcr_err {
+	int64_t min;
+	int64_t max;
+	uint64_t n;
+	uint64_t hist[PCR_HIST];
+};
+
+struct pcr_pid {
+	uint16_t pid;
+	uint64_t pcrs;
+	uint64_t restarts;
+	uint64_t last; /* PCR */
+	uint64_t y; /* PCR ticks since the lines started */
+	uint64_t x0; /* byte offset the lines started at */
+	uint64_t t0; /* arrival time the lines started at, 0 for none */
+	struct pcr_fit bytes;
+	struct pcr_fit arrival;
+	struct pcr_fit block;
+	uint64_t block_start;
+	struct pcr_err ac;
+	struct pcr_err oj;
+	int fo_valid; /* fo_block follows on from the block before */
+	uint64_t fo_blocks;
+	double fo_block; /* ppm */
+	double fo_min;
+	double fo_max;
+	double dr_max; /* largest change of fo_block, ppm/s */
+};
+
+static struct {
+	uint8_t index[MAX_TS_PID_NUM]; /* in pids + 1, 0 for none */
+	uint16_t program[MAX_TS_PID_NUM]; /* the PID is PCR_PID of */
+	struct pcr_pid pids[PCR_PIDS];
+	int num;
+} pcrs;
+
+void pcr_init(void)
+{
+	memset(&pcrs, 0, sizeof(pcrs));
+}
+
+void pcr_program(uint16_t pid, uint16_t program)
+{
+	pcrs.program[pid] = program;
+}
+
+static void pcr_fit_add(struct pcr_fit *f, double x, double y)
+{
+	double dx = x - f->mx;
+
+	f->n++;
+	f->mx += dx / (double)f->n;
+	f->my += (y - f->my) / (double)f->n;
+	f->m2x += dx * (x - f->mx);
+	f->cxy += dx * (y - f->my);
+}
+
+static double pcr_fit_slope(const struct pcr_fit *f)
+{
+	return f->m2x > 0 ? f->cxy / f->m2x : 0;
+}
+
+/* y above the line at x */
+static double pcr_fit_error(const struct pcr_fit *f, double x, double y)
+{
+	return y - (f->my + pcr_fit_slope(f) * (x - f->mx));
+}
+
+/* offset of a slope in PCR ticks per ns from 27 MHz */
+static double pcr_fit_ppm(const struct pcr_fit *f)
+{
+	return (pcr_fit_slope(f) * 1e9 / SYS_CLK - 1) * 1e6;
+}
+
+static void pcr_err_add(struct pcr_err *e, double ns)
+{
+	int64_t v = (int64_t)(ns < 0 ? ns - 0.5 : ns + 0.5);
+	uint64_t a = (uint64_t)(v < 0 ? -v : v);
+	int k = 0;
+
+	if (e->n == 0 || v < e->min)
+		e->min = v;
+	if (e->n == 0 || v > e->max)
+		e->max = v;
+	e->n++;
+	if (a >= 128)
+		k = 64 - __builtin_clzll(a) - 7;
+	if (k >= PCR_HIST)
+		k = PCR_HIST - 1;
+	e->hist[k]++;
+}
+
+static struct pcr_pid *pcr_pid(uint16_t pid)
+{
+	struct pcr_pid *p;
+
+	if (pcrs.index[pid])
+		return &pcrs.pids[pcrs.index[pid] - 1];
+	if (pcrs.num == PCR_PIDS)
+		return NULL;
+	p = &pcrs.pids[pcrs.num++];
+	p->pid = pid;
+	pcrs.index[pid] = (uint8_t)pcrs.num;
+	return p;
+}
+
+/* new lines from this PCR on, the errors found so far are kept */
+static void pcr_restart(struct pcr_pid *p, uint64_t offset, uint64_t stamp)
+{
+	memset(&p->bytes, 0, sizeof(p->bytes));
+	memset(&p->arrival, 0, sizeof(p->arrival));
+	memset(&p->block, 0, sizeof(p->block));
+	p->y = 0;
+	p->x0 = offset;
+	p->t0 = stamp;
+	p->block_start = stamp;
+	p->fo_valid = 0;
+}
+
+/* PCR_FO of a block of arrival time, PCR_DR from the block before */
+static void pcr_block_end(struct pcr_pid *p, uint64_t stamp)
+{
+	double fo = pcr_fit_ppm(&p->block), dr;
+
+	if (p->fo_valid) {
+		dr = (fo - p->fo_block) * 1e9 / (double)(stamp - p->block_start);
+		if (dr < 0)
+			dr = -dr;
+		if (dr > p->dr_max)
+			p->dr_max = dr;
+	}
+	if (p->fo_blocks == 0 || fo < p->fo_min)
+		p->fo_min = fo;
+	if (p->fo_blocks == 0 || fo > p->fo_max)
+		p->fo_max = fo;
+	p->fo_blocks++;
+	p->fo_block = fo;
+	p->fo_valid = 1;
+	memset(&p->block, 0, sizeof(p->block));
+	p->block_start = stamp;
+}
+
+void pcr_sample(uint16_t pid, uint64_t pcr, int discontinuity, uint64_t offset, uint64_t stamp)
+{
+	struct pcr_pid *p = pcr_pid(pid);
+	uint64_t d;
+	double x, t;
+
+	if (p == NULL)
+		return;
+	d = (pcr + PCR_MOD - p->last) % PCR_MOD;
+	if (p->pcrs == 0 || discontinuity || d == 0 || d > PCR_GAP || offset <= p->x0 || stamp < p->t0) {
+		if (p->pcrs)
+			p->restarts++;
+		pcr_restart(p, offset, stamp);
+	} else {
+		p->y += d;
+	}
+	p->pcrs++;
+	p->last = pcr;
+
+	/* each PCR is measured against the line through the ones before */
+	x = (double)(offset - p->x0);
+	if (p->bytes.n >= PCR_WARMUP)
+		pcr_err_add(&p->ac, PCR_NS(pcr_fit_error(&p->bytes, x, (double)p->y)));
+	pcr_fit_add(&p->bytes, x, (double)p->y);
+
+	if (p->t0 == 0)
+		return;
+	t = (double)(stamp - p->t0);
+	if (p->arrival.n >= PCR_WARMUP)
+		pcr_err_add(&p->oj, PCR_NS(pcr_fit_error(&p->arrival, t, (double)p->y)));
+	pcr_fit_add(&p->arrival, t, (double)p->y);
+	if (stamp - p->block_start >= PCR_BLOCK && p->block.n >= PCR_WARMUP)
+		pcr_block_end(p, stamp);
+	pcr_fit_add(&p->block, t, (double)p->y);
+}
+
+static void pcr_ns_str(char *buf, size_t len, const struct pcr_err *e, int64_t v)
+{
+	if (e->n)
+		snprintf(buf, len, "%" PRId64, v);
+	else
+		snprintf(buf, len, "-");
+}
+
+void dump_pcr(void)
+{
+	struct pcr_pid *p;
+	char name[24], prog[16], ac_min[24], ac_max[24], oj_min[24], oj_max[24], fo[24], dr[24];
+	int i, k;
+
+	if (pcrs.num == 0)
+		return;
+	printf("\n");
+	printf("PCR:\n");
+	printf("  PCR_AC against byte position, PCR_OJ, PCR_FO and PCR_DR against arrival time\n");
+	printf("%-14s%8s%10s%10s%10s%12s%12s%10s%10s%10s\n", "PID", "Program", "PCRs", "Restarts", "AC min", "AC max",
+		   "OJ min", "OJ max", "FO ppm", "DR mHz/s");
+	for (i = 0; i < pcrs.num; i++) {
+		p = &pcrs.pids[i];
+		snprintf(name, sizeof(name), "%04d(0x%04x)", p->pid, p->pid);
+		if (pcrs.program[p->pid])
+			snprintf(prog, sizeof(prog), "%d", pcrs.program[p->pid]);
+		else
+			snprintf(prog, sizeof(prog), "-");
+		pcr_ns_str(ac_min, sizeof(ac_min), &p->ac, p->ac.min);
+		pcr_ns_str(ac_max, sizeof(ac_max), &p->ac, p->ac.max);
+		pcr_ns_str(oj_min, sizeof(oj_min), &p->oj, p->oj.min);
+		pcr_ns_str(oj_max, sizeof(oj_max), &p->oj, p->oj.max);
+		if (p->oj.n)
+			snprintf(fo, sizeof(fo), "%.3f", pcr_fit_ppm(&p->arrival));
+		else
+			snprintf(fo, sizeof(fo), "-");
+		/* 1 ppm of 27 MHz is 27 Hz */
+		if (p->fo_blocks > 1)
+			snprintf(dr, sizeof(dr), "%.3f", p->dr_max * 27000);
+		else
+			snprintf(dr, sizeof(dr), "-");
+		printf("%-14s%8s%10" PRIu64 "%10" PRIu64 "%10s%12s%12s%10s%10s%10s\n", name, prog, p->pcrs, p->restarts,
+			   ac_min, ac_max, oj_min, oj_max, fo, dr);
+	}
+
+	for (i = 0; i < pcrs.num; i++) {
+		p = &pcrs.pids[i];
+		if (p->ac.n == 0 && p->oj.n == 0)
+			continue;
+		printf("\n");
+		printf("PCR error histogram of PID 0x%04x, ns:\n", p->pid);
+		if (p->fo_blocks)
+			printf("  PCR_FO of %" PRIu64 " s blocks from %.3f to %.3f ppm\n", (uint64_t)(PCR_BLOCK / 1000000000ULL), p->fo_min,
+				   p->fo_max);
+		printf("%14s%12s%12s\n", "|error| below", "PCR_AC", "PCR_OJ");
+		for (k = 0; k < PCR_HIST; k++) {
+			if (p->ac.hist[k] == 0 && p->oj.hist[k] == 0)
+				continue;
+			if (k == PCR_HIST - 1)
+				snprintf(name, sizeof(name), "more");
+			else
+				snprintf(name, sizeof(name), "%llu", 128ULL << k);
+			printf("%14s%12" PRIu64 "%12" PRIu64 "\n", name, p->ac.hist[k], p->oj.hist[k]);
+		}
+	}
+}
+
+void dump_pcr_res(void)
+{
+	struct pcr_pid *p;
+	int i, k;
+
+	if (pcrs.num == 0)
+		return;
+	rout(0, "PCR");
+	for (i = 0; i < pcrs.num; i++) {
+		p = &pcrs.pids[i];
+		rout(1, "PCR_PID 0x%x", p->pid);
+		if (pcrs.program[p->pid])
+			rout(2, "program_number : %d", pcrs.program[p->pid]);
+		rout(2, "PCRs           : %" PRIu64, p->pcrs);
+		rout(2, "restarts       : %" PRIu64, p->restarts);
+		if (p->ac.n)
+			rout(2, "PCR_AC         : min %" PRId64 " max %" PRId64 " ns", p->ac.min, p->ac.max);
+		if (p->oj.n) {
+			rout(2, "PCR_OJ         : min %" PRId64 " max %" PRId64 " ns", p->oj.min, p->oj.max);
+			rout(2, "PCR_FO         : %.3f ppm", pcr_fit_ppm(&p->arrival));
+		}
+		if (p->fo_blocks)
+			rout(2, "PCR_FO blocks  : min %.3f max %.3f ppm", p->fo_min, p->fo_max);
+		if (p->fo_blocks > 1)
+			rout(2, "PCR_DR         : %.3f mHz/s", p->dr_max * 27000);
+		if (p->ac.n == 0 && p->oj.n == 0)
+			continue;
+		rout(2, "histogram      : |error| below ns, PCR_AC, PCR_OJ");
+		for (k = 0; k < PCR_HIST; k++) {
+			if (p->ac.hist[k] == 0 && p->oj.hist[k] == 0)
+				continue;
+			if (k == PCR_HIST - 1)
+				rout(3, "%14s : %" PRIu64 " %" PRIu64, "more", p->ac.hist[k], p->oj.hist[k]);
+			else
+				rout(3, "%14llu : %" PRIu64 " %" PRIu64, 128ULL << k, p->ac.hist[k], p->oj.hist[k]);
+		}
+	}
+}
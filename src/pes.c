@@ -155,13 +155,22 @@ typedef struct {
 
 static mpegts_pes_t pes;
 
+/*
+ * every PMT repetition lands here, the filter is set up once. PES packets
+ * are only reassembled for PIDs picked with -p, the others are counted
+ */
 void register_pes_ops(uint16_t pid)
 {
-	if ((pes.pid_bitmap[ pid / 64] & ((uint64_t) 1 << (pid % 64))) == 0) {
-		pes.pid_bitmap[ pid / 64] |= ((uint64_t) 1 << (pid % 64));
-		pes.pid_num ++;
-	}
+	if ((pes.pid_bitmap[ pid / 64] & ((uint64_t) 1 << (pid % 64))) != 0)
+		return;
+	pes.pid_bitmap[ pid / 64] |= ((uint64_t) 1 << (pid % 64));
+	pes.pid_num ++;
+	if (!get_config()->pids[pid])
+		return;
 	filter_t *f = filter_alloc(pid);
+	if (f == NULL)
+		return;
+	f->type = FILTER_PES;
 	filter_param_t para;
 	para.depth = 1;
 	para.coff[0] = 0;
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bufring.h"
+#include "io.h"
+#include "ts.h"
+
+/*
+ * stdin, pipe and FIFO input: a bufring thread drains the pipe into a ring
+ * of large buffers so the writer keeps going while ts_process() works on an
+ * earlier buffer. a buffer is handed out once it is full or the writer has
+ * nothing more queued, so slow live pipes are not held back.
+ * "-" or "pipe:" reads stdin, "pipe:path" opens a FIFO
+ */
+
+#define PIPE_BUFS (4)
+#define PIPE_DEFAULT_BLOCK (4 * 1024 * 1024)
+#define PIPE_MIN_CAPACITY (64 * 1024)
+
+static struct io_ops pipe_ops;
+
+static struct {
+	struct bufring ring;
+	int own_fd; /* fd was opened here, not inherited */
+} pio;
+
+/* fewer wakeups per MB with a larger pipe, shrink the request until it fits */
+static void pipe_grow(int fd)
+{
+#ifdef F_SETPIPE_SZ
+	struct stat st;
+	int size = (int)pipe_ops.block_size;
+
+	if (fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode))
+		return;
+	while (size >= PIPE_MIN_CAPACITY && fcntl(fd, F_SETPIPE_SZ, size) < 0)
+		size /= 2;
+#else
+	(void)fd;
+#endif
+}
+
+static ssize_t pipe_fill(uint8_t *data, size_t size)
+{
+	struct pollfd pfd = { .fd = pipe_ops.fd, .events = POLLIN };
+	size_t got = 0;
+	ssize_t ret;
+
+	while (got < size) {
+		ret = read(pipe_ops.fd, data + got, size - got);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			printf("pipe: read error %s\n", strerror(errno));
+			/* hand out what came before it first */
+			return got ? (ssize_t)got : -1;
+		}
+		if (ret == 0)
+			break;
+		got += (size_t)ret;
+		/* writer is idle, do not sit on what arrived */
+		if (poll(&pfd, 1, 0) == 0)
+			break;
+	}
+	return (ssize_t)got;
+}
+
+static int pipeio_close(void);
+
+static int pipeio_open(const char *name)
+{
+	struct tsa_config *tsaconf = get_config();
+
+	if (name == NULL)
+		return -1;
+	memset(&pio, 0, sizeof(pio));
+	if (strncmp(name, "pipe:", 5) == 0)
+		name += 5;
+	if (name[0] == '\0' || strcmp(name, "-") == 0) {
+		pipe_ops.fd = STDIN_FILENO;
+	} else {
+		pipe_ops.fd = open(name, O_RDONLY);
+		if (pipe_ops.fd < 0)
+			return -1;
+		pio.own_fd = 1;
+	}
+	pipe_ops.block_size = PIPE_DEFAULT_BLOCK;
+	if (tsaconf->mem)
+		pipe_ops.block_size = (size_t)tsaconf->mem * 1024 * 1024;
+	pipe_ops.offset = 0;
+	pipe_grow(pipe_ops.fd);
+
+	if (bufring_open(&pio.ring, PIPE_BUFS, pipe_ops.block_size, 0, pipe_fill, 1) < 0)
+		goto fail;
+	return 0;
+
+fail:
+	pipeio_close();
+	return -1;
+}
+
+static int pipeio_read(void **ptr, size_t *len)
+{
+	if (bufring_read(&pio.ring, ptr, len) < 0)
+		return -1;
+	pipe_ops.ptr = *ptr;
+	pipe_ops.offset += *len;
+	return 0;
+}
+
+static int pipeio_close(void)
+{
+	bufring_close(&pio.ring);
+	if (pio.own_fd && pipe_ops.fd >= 0)
+		close(pipe_ops.fd);
+	pipe_ops.fd = -1;
+	pipe_ops.ptr = NULL;
+	return 0;
+}
+
+static int64_t pipeio_end(void)
+{
+	return bufring_end(&pio.ring);
+}
+
+static struct io_ops pipe_ops = {
+	.type = IO_PIPE,
+	.fd = -1,
+	.open = pipeio_open,
+	.read = pipeio_read,
+	.close = pipeio_close,
+	.end = pipeio_end,
+};
+
+REGISTER_IO_OPS(pipe, &pipe_ops);
@@ -0,0 +1,931 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "fec.h"
+#include "io.h"
+#include "mdi.h"
+#include "rtp.h"
+#include "ts.h"
+#include "udp.h"
+
+/*
+ * RTP (RFC 3550) carrying MPEG2 TS (RFC 2250). datagrams are received in
+ * batches into a pool of buffers and sorted into a small reorder window by
+ * sequence number. read() hands out one payload at a time as a pointer into
+ * the pool, past the RTP header, CSRC list and header extension, so nothing
+ * is copied. kernel receive timestamps feed the MDI figures, lost and
+ * reordered datagrams count as media loss. datagrams the socket dropped
+ * are part of the lost ones, the rest went missing on the network.
+ *
+ * hitless input (SMPTE 2022-7) receives the same stream on two legs and
+ * sorts both into one window, whichever copy of a sequence number comes
+ * first is handed out. one thread polls both sockets, so the merge needs
+ * no locking. the window is wide enough to cover the path delay
+ * difference, a leg misses a datagram it did not deliver before its
+ * window slot is taken by a later one. a gap neither leg fills within
+ * RTP_WIDE_DELAY_MS is given up.
+ *
+ * with fec=1 the SMPTE 2022-1 column (port + 2) and row (port + 4) FEC
+ * streams are received as well. handed out packets stay in a short history
+ * instead of going back to the pool, a missing packet is rebuilt by XOR
+ * once a FEC packet protects it and all its other packets are at hand, but
+ * not before the window would give it up. rows and columns are tried in
+ * turn until nothing more can be rebuilt, an original that still comes
+ * replaces its rebuilt copy.
+ */
+
+#define RTP_BATCH (32)
+#define RTP_WINDOW (32) /* must be a power of 2 */
+#define RTP_WIDE_WINDOW (512) /* merged or FEC protected, must be a power of 2 */
+#define RTP_WIDE_DELAY_MS (150) /* longest a gap holds a wide window back */
+#define RTP_LEGS (2)
+#define RTP_PEND (RTP_BATCH * RTP_LEGS)
+#define RTP_FEC_HISTORY (256) /* covers a 2022-1 matrix of up to 100 packets, must be a power of 2 */
+#define RTP_FEC_MAX (256) /* FEC packets waiting until half a wide window is held, 0.5 per media packet at 4x4 */
+#define RTP_POOL_MAX (RTP_WIDE_WINDOW + RTP_PEND + RTP_BATCH + 1 + RTP_FEC_HISTORY)
+
+static struct io_ops rtp_ops;
+static struct io_ops hitless_ops;
+
+struct rtp_pkt {
+	uint8_t *data;
+	uint16_t seq;
+	uint16_t off; /* payload offset in data */
+	uint16_t len; /* payload length */
+	uint16_t size; /* datagram length */
+	uint8_t leg; /* received on */
+	uint8_t rebuilt; /* by FEC, not received */
+	uint64_t stamp; /* arrival in ns */
+};
+
+struct rtp_stats {
+	uint64_t received;
+	uint64_t lost;
+	uint64_t reordered;
+	uint64_t duplicate;
+	uint64_t late;
+	uint64_t invalid;
+};
+
+struct rtp_fec {
+	uint8_t *data;
+	uint16_t off; /* FEC payload offset in data */
+	uint16_t plen; /* FEC payload length */
+	int used;
+	struct fec_header h;
+};
+
+/* one socket the session receives from */
+struct rtp_leg {
+	int fd;
+	int started;
+	uint16_t highest;
+	struct rtp_stats stats;
+	struct mdi mdi;
+	struct udp_rx rx;
+};
+
+struct rtp_session {
+	uint8_t *pool;
+	struct rtp_pkt pkt[RTP_POOL_MAX];
+	int free_idx[RTP_POOL_MAX];
+	int free_num;
+	int window; /* slots in use, a power of 2 */
+	int mask;
+	int win[RTP_WIDE_WINDOW]; /* pool index by seq, -1 when empty */
+	int32_t done[RTP_WIDE_WINDOW]; /* seq last handed out per slot, to tell duplicates from late packets */
+	int32_t sseq[RTP_WIDE_WINDOW]; /* seq the legs mask of a slot belongs to, -1 if none */
+	uint8_t legs[RTP_WIDE_WINDOW]; /* legs that delivered sseq */
+	int held; /* packets sitting in the window */
+	int cur; /* packet owned by the caller, -1 if none */
+	int pend[RTP_PEND]; /* packets too far ahead of the window */
+	int pend_num;
+	int stale; /* packets in a row behind the window */
+	int started;
+	uint16_t expect; /* next sequence number to hand out */
+	uint16_t highest;
+	struct mmsghdr msgs[RTP_BATCH];
+	struct iovec iov[RTP_BATCH];
+	uint8_t cmsg[RTP_BATCH][UDP_CMSG_SPACE];
+	int idx[RTP_BATCH];
+	uint64_t ts_per_dgram; /* TS packets in a datagram, to turn datagram loss into media loss */
+	uint64_t recovered; /* datagrams one leg missed and another delivered */
+	uint64_t last; /* latest arrival in ns */
+	uint64_t gap_since; /* arrival time when the merged stream got stuck at expect, 0 if it is not */
+	struct rtp_stats stats; /* of the stream handed out */
+	struct rtp_leg leg[RTP_LEGS];
+	int nlegs;
+	/* 2022-1, columns on fec_fd[0], rows on fec_fd[1], -1 when not received */
+	int fec_fd[2];
+	int fec_on;
+	int fec_dirty; /* something arrived since the last recovery attempt */
+	uint8_t *fec_pool;
+	struct rtp_fec fec[RTP_FEC_MAX];
+	int hist[RTP_FEC_HISTORY]; /* pool index of handed out packets by seq, -1 when empty */
+	uint64_t fec_received[2];
+	uint64_t fec_invalid;
+	uint64_t fec_recovered;
+	uint8_t fec_l; /* matrix as the column FEC tells */
+	uint8_t fec_d;
+};
+
+static struct rtp_session rtp;
+
+/* fec_fds is NULL without FEC */
+static int rtp_session_init(struct rtp_session *s, const int *fds, int nlegs, const int *fec_fds)
+{
+	int i, pool_num;
+	memset(s, 0, sizeof(*s));
+	s->cur = -1;
+	s->nlegs = nlegs;
+	s->fec_fd[0] = fec_fds != NULL ? fec_fds[0] : -1;
+	s->fec_fd[1] = fec_fds != NULL ? fec_fds[1] : -1;
+	s->fec_on = fec_fds != NULL;
+	s->window = (nlegs > 1 || s->fec_on) ? RTP_WIDE_WINDOW : RTP_WINDOW;
+	s->mask = s->window - 1;
+	pool_num = s->window + RTP_PEND + RTP_BATCH + 1 + (s->fec_on ? RTP_FEC_HISTORY : 0);
+	s->ts_per_dgram = 7;
+	for (i = 0; i < nlegs; i++) {
+		s->leg[i].fd = fds[i];
+		mdi_init(&s->leg[i].mdi, get_config()->mdi_interval);
+		udp_rx_init(&s->leg[i].rx, fds[i]);
+	}
+	s->pool = malloc((size_t)pool_num * UDP_MAX_DGRAM);
+	if (s->pool == NULL)
+		return -1;
+	for (i = 0; i < pool_num; i++) {
+		s->pkt[i].data = s->pool + i * UDP_MAX_DGRAM;
+		s->free_idx[i] = i;
+	}
+	s->free_num = pool_num;
+	for (i = 0; i < s->window; i++) {
+		s->win[i] = -1;
+		s->done[i] = -1;
+		s->sseq[i] = -1;
+	}
+	for (i = 0; i < RTP_FEC_HISTORY; i++)
+		s->hist[i] = -1;
+	if (s->fec_on) {
+		s->fec_pool = malloc(RTP_FEC_MAX * UDP_MAX_DGRAM);
+		if (s->fec_pool == NULL)
+			return -1;
+		for (i = 0; i < RTP_FEC_MAX; i++)
+			s->fec[i].data = s->fec_pool + i * UDP_MAX_DGRAM;
+	}
+	return 0;
+}
+
+static void rtp_session_uninit(struct rtp_session *s)
+{
+	int i;
+	for (i = 0; i < s->nlegs; i++) {
+		if (s->leg[i].fd >= 0)
+			close(s->leg[i].fd);
+		s->leg[i].fd = -1;
+	}
+	for (i = 0; i < 2; i++) {
+		if (s->fec_fd[i] >= 0)
+			close(s->fec_fd[i]);
+		s->fec_fd[i] = -1;
+	}
+	free(s->pool);
+	s->pool = NULL;
+	free(s->fec_pool);
+	s->fec_pool = NULL;
+}
+
+static inline void rtp_put(struct rtp_session *s, int idx)
+{
+	s->free_idx[s->free_num++] = idx;
+}
+
+int rtp_parse_header(const uint8_t *b, size_t len, uint16_t *seq, uint16_t *off, uint16_t *plen)
+{
+	size_t hlen = RTP_HEADER_LEN;
+
+	if (unlikely(len < RTP_HEADER_LEN || (b[0] >> 6) != 2))
+		return -1;
+	hlen += (b[0] & 0x0F) * 4;
+	if (b[0] & 0x10) {
+		if (hlen + 4 > len)
+			return -1;
+		hlen += 4 + TS_READ16(b + hlen + 2) * 4;
+	}
+	if (b[0] & 0x20) {
+		if (b[len - 1] > len)
+			return -1;
+		len -= b[len - 1];
+	}
+	if (unlikely(hlen > len))
+		return -1;
+	*seq = TS_READ16(b + 2);
+	*off = (uint16_t)hlen;
+	*plen = (uint16_t)(len - hlen);
+	return 0;
+}
+
+static inline void rtp_lost(struct rtp_session *s, uint64_t n)
+{
+	s->stats.lost += n;
+	/* merged streams count media loss per leg */
+	if (s->nlegs == 1)
+		mdi_loss(&s->leg[0].mdi, n * s->ts_per_dgram);
+}
+
+/* the slot moves on to a later seq, legs that did not deliver the old one missed it */
+static void rtp_leg_retire(struct rtp_session *s, int slot)
+{
+	int i;
+
+	if (s->sseq[slot] < 0)
+		return;
+	for (i = 0; i < s->nlegs; i++) {
+		if (s->legs[slot] & (1 << i))
+			continue;
+		s->leg[i].stats.lost++;
+		mdi_loss(&s->leg[i].mdi, s->ts_per_dgram);
+		if (s->legs[slot])
+			s->recovered++;
+	}
+	s->legs[slot] = 0;
+}
+
+/* track seq in its slot, 0 if it is newer than what the slot holds */
+static int rtp_leg_slot(struct rtp_session *s, uint16_t seq)
+{
+	int slot = seq & s->mask;
+
+	if (s->sseq[slot] == seq)
+		return 0;
+	if (s->sseq[slot] >= 0 && (int16_t)(seq - (uint16_t)s->sseq[slot]) < 0)
+		return -1;
+	rtp_leg_retire(s, slot);
+	s->sseq[slot] = seq;
+	return 0;
+}
+
+/* account a datagram of a merged leg, -1 when the leg already delivered it or it is too old */
+static int rtp_leg_seen(struct rtp_session *s, struct rtp_leg *l, uint16_t seq)
+{
+	int slot = seq & s->mask, bit = 1 << (int)(l - s->leg);
+
+	if (rtp_leg_slot(s, seq) < 0) {
+		l->stats.late++;
+		return -1;
+	}
+	if (s->legs[slot] & bit) {
+		l->stats.duplicate++;
+		return -1;
+	}
+	s->legs[slot] |= (uint8_t)bit;
+	if (!l->started || (int16_t)(seq - l->highest) > 0) {
+		l->started = 1;
+		l->highest = seq;
+	} else {
+		l->stats.reordered++;
+		mdi_loss(&l->mdi, s->ts_per_dgram);
+	}
+	return 0;
+}
+
+static inline int rtp_parse(struct rtp_pkt *p, size_t len)
+{
+	return rtp_parse_header(p->data, len, &p->seq, &p->off, &p->len);
+}
+
+static void rtp_insert(struct rtp_session *s, struct rtp_leg *l, int idx)
+{
+	struct rtp_pkt *p = &s->pkt[idx];
+	int16_t d;
+
+	if (unlikely(!s->started)) {
+		s->started = 1;
+		s->expect = p->seq;
+		s->highest = p->seq;
+	}
+	d = (int16_t)(p->seq - s->expect);
+	if (unlikely(d >= s->window || d < -s->window)) {
+		/* a leg that far behind the other one is of no use */
+		if (s->nlegs > 1 && d < 0 && ++s->stale < s->window) {
+			l->stats.late++;
+			rtp_put(s, idx);
+			return;
+		}
+		/* outage or sender restart, wait until the window drained */
+		if (s->pend_num == RTP_PEND) {
+			l->stats.late++;
+			rtp_put(s, idx);
+			return;
+		}
+		s->pend[s->pend_num++] = idx;
+		return;
+	}
+	s->stale = 0;
+	if (s->nlegs > 1) {
+		if (rtp_leg_seen(s, l, p->seq) < 0) {
+			rtp_put(s, idx);
+			return;
+		}
+		/* the copy of the other leg is handed out already, or was given up on */
+		if (d < 0 || s->win[p->seq & s->mask] >= 0) {
+			if (d < 0 && s->done[p->seq & s->mask] != p->seq)
+				l->stats.late++;
+			rtp_put(s, idx);
+			return;
+		}
+		s->win[p->seq & s->mask] = idx;
+		s->held++;
+		return;
+	}
+	if (d < 0) {
+		if (s->done[p->seq & s->mask] == p->seq)
+			s->stats.duplicate++;
+		else
+			s->stats.late++;
+		rtp_put(s, idx);
+		return;
+	}
+	if ((int16_t)(p->seq - s->highest) > 0)
+		s->highest = p->seq;
+	else if (p->seq != s->highest) {
+		s->stats.reordered++;
+		mdi_loss(&l->mdi, s->ts_per_dgram);
+	}
+	if (s->win[p->seq & s->mask] >= 0) {
+		/* the original came after all, it replaces the rebuilt copy */
+		if (s->pkt[s->win[p->seq & s->mask]].rebuilt) {
+			rtp_put(s, s->win[p->seq & s->mask]);
+			s->win[p->seq & s->mask] = idx;
+			s->fec_recovered--;
+			return;
+		}
+		s->stats.duplicate++;
+		rtp_put(s, idx);
+		return;
+	}
+	s->win[p->seq & s->mask] = idx;
+	s->held++;
+}
+
+/* window is empty, continue at the sequence number the stream jumped to */
+static void rtp_resync(struct rtp_session *s)
+{
+	int i, n = s->pend_num, pend[RTP_PEND];
+	int16_t d = (int16_t)(s->pkt[s->pend[0]].seq - s->expect);
+
+	if (d > 0)
+		rtp_lost(s, (uint64_t)d);
+	s->expect = s->pkt[s->pend[0]].seq;
+	s->highest = s->expect;
+	memcpy(pend, s->pend, n * sizeof(int));
+	s->pend_num = 0;
+	s->stale = 0;
+	/* the legs start over too */
+	for (i = 0; i < s->window; i++) {
+		s->sseq[i] = -1;
+		s->legs[i] = 0;
+	}
+	for (i = 0; i < n; i++)
+		rtp_insert(s, &s->leg[s->pkt[pend[i]].leg], pend[i]);
+}
+
+static int rtp_receive(struct rtp_session *s, struct rtp_leg *l, int flags)
+{
+	int i, n, want = s->free_num < RTP_BATCH ? s->free_num : RTP_BATCH;
+	struct timespec now;
+	uint64_t t = 0, fallback = 0, bytes = 0;
+	uint32_t drops = l->rx.drops;
+
+	for (i = 0; i < want; i++) {
+		s->idx[i] = s->free_idx[--s->free_num];
+		s->iov[i].iov_base = s->pkt[s->idx[i]].data;
+		s->iov[i].iov_len = UDP_MAX_DGRAM;
+		memset(&s->msgs[i].msg_hdr, 0, sizeof(s->msgs[i].msg_hdr));
+		s->msgs[i].msg_hdr.msg_iov = &s->iov[i];
+		s->msgs[i].msg_hdr.msg_iovlen = 1;
+		s->msgs[i].msg_hdr.msg_control = s->cmsg[i];
+		s->msgs[i].msg_hdr.msg_controllen = UDP_CMSG_SPACE;
+	}
+	do {
+		n = recvmmsg(l->fd, s->msgs, want, flags, NULL);
+	} while (n < 0 && errno == EINTR);
+
+	for (i = 0; i < want; i++) {
+		if (i >= n || rtp_parse(&s->pkt[s->idx[i]], s->msgs[i].msg_len) < 0) {
+			if (i < n)
+				l->stats.invalid++;
+			rtp_put(s, s->idx[i]);
+			continue;
+		}
+		l->stats.received++;
+		t = udp_msg_info(&s->msgs[i].msg_hdr, &drops);
+		if (unlikely(t == 0)) {
+			if (fallback == 0) {
+				clock_gettime(CLOCK_REALTIME, &now);
+				fallback = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+			}
+			t = fallback;
+		}
+		s->pkt[s->idx[i]].stamp = t;
+		s->pkt[s->idx[i]].size = (uint16_t)s->msgs[i].msg_len;
+		s->pkt[s->idx[i]].leg = (uint8_t)(l - s->leg);
+		s->pkt[s->idx[i]].rebuilt = 0;
+		mdi_arrival(&l->mdi, t, s->pkt[s->idx[i]].len);
+		bytes += s->msgs[i].msg_len;
+		if (s->pkt[s->idx[i]].len >= TS_PACKET_SIZE)
+			s->ts_per_dgram = s->pkt[s->idx[i]].len / TS_PACKET_SIZE;
+		rtp_insert(s, l, s->idx[i]);
+	}
+	if (t != 0) {
+		udp_rx_update(&l->rx, t, bytes, drops);
+		if (t > s->last)
+			s->last = t;
+	}
+	s->fec_dirty = 1;
+	return n;
+}
+
+/* a free FEC slot, the one furthest behind is reused when all are taken */
+static struct rtp_fec *rtp_fec_slot(struct rtp_session *s)
+{
+	int i, old = 0;
+
+	for (i = 0; i < RTP_FEC_MAX; i++) {
+		if (!s->fec[i].used)
+			return &s->fec[i];
+		if ((int16_t)(s->fec[i].h.base - s->fec[old].h.base) < 0)
+			old = i;
+	}
+	s->fec[old].used = 0;
+	return &s->fec[old];
+}
+
+static void rtp_fec_receive(struct rtp_session *s, int fd)
+{
+	struct rtp_fec *f;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < RTP_BATCH; i++) {
+		f = rtp_fec_slot(s);
+		n = recv(fd, f->data, UDP_MAX_DGRAM, MSG_DONTWAIT);
+		if (n < 0)
+			break;
+		/* P, X and CC of a FEC packet are recovery bits, the FEC header follows the fixed header */
+		if (n < RTP_HEADER_LEN + FEC_HEADER_LEN || (f->data[0] >> 6) != 2 ||
+			fec_parse_header(f->data + RTP_HEADER_LEN, (size_t)n - RTP_HEADER_LEN, &f->h) < 0) {
+			s->fec_invalid++;
+			continue;
+		}
+		f->off = RTP_HEADER_LEN + FEC_HEADER_LEN;
+		f->plen = (uint16_t)(n - RTP_HEADER_LEN - FEC_HEADER_LEN);
+		f->used = 1;
+		s->fec_received[f->h.row]++;
+		if (!f->h.row) {
+			s->fec_l = f->h.offset;
+			s->fec_d = f->h.na;
+		}
+		s->fec_dirty = 1;
+	}
+}
+
+/* pool index of seq while it is still around, -1 if not */
+static int rtp_fec_find(struct rtp_session *s, uint16_t seq)
+{
+	int idx;
+	int16_t d = (int16_t)(seq - s->expect);
+
+	if (d >= 0 && d < s->window) {
+		idx = s->win[seq & s->mask];
+		return (idx >= 0 && s->pkt[idx].seq == seq) ? idx : -1;
+	}
+	if (s->cur >= 0 && s->pkt[s->cur].seq == seq)
+		return s->cur;
+	idx = s->hist[seq & (RTP_FEC_HISTORY - 1)];
+	return (idx >= 0 && s->pkt[idx].seq == seq) ? idx : -1;
+}
+
+/* handed out packets stay around for recovery until their slot is reused */
+static void rtp_hist_put(struct rtp_session *s, int idx)
+{
+	int slot = s->pkt[idx].seq & (RTP_FEC_HISTORY - 1);
+
+	if (s->hist[slot] >= 0)
+		rtp_put(s, s->hist[slot]);
+	s->hist[slot] = idx;
+}
+
+/*
+ * rebuild seq from f and the other packets it protects. everything past the
+ * fixed RTP header is XORed, the P, X, CC and M bits come out of the FEC
+ * packet header the same way (RFC 2733)
+ */
+static int rtp_fec_rebuild(struct rtp_session *s, struct rtp_fec *f, uint16_t seq)
+{
+	struct rtp_pkt *p, *q = NULL;
+	uint16_t len = f->h.length, m;
+	uint8_t b0 = f->data[0], b1 = (uint8_t)((f->data[1] & 0x80) | f->h.pt);
+	uint32_t ts = f->h.ts;
+	size_t n;
+	int i, idx;
+
+	if (s->free_num == 0)
+		return -1;
+	idx = s->free_idx[--s->free_num];
+	p = &s->pkt[idx];
+	memcpy(p->data + RTP_HEADER_LEN, f->data + f->off, f->plen);
+	for (i = 0; i < f->h.na; i++) {
+		m = (uint16_t)(f->h.base + i * f->h.offset);
+		if (m == seq)
+			continue;
+		q = &s->pkt[rtp_fec_find(s, m)];
+		n = q->size - RTP_HEADER_LEN;
+		len ^= (uint16_t)n;
+		b0 ^= q->data[0];
+		b1 ^= q->data[1];
+		ts ^= TS_READ32(q->data + 4);
+		fec_xor(p->data + RTP_HEADER_LEN, q->data + RTP_HEADER_LEN, n < f->plen ? n : f->plen);
+	}
+	if (len > f->plen) {
+		rtp_put(s, idx);
+		return -1;
+	}
+	p->data[0] = (uint8_t)(0x80 | (b0 & 0x3F));
+	p->data[1] = b1;
+	p->data[2] = (uint8_t)(seq >> 8);
+	p->data[3] = (uint8_t)seq;
+	p->data[4] = (uint8_t)(ts >> 24);
+	p->data[5] = (uint8_t)(ts >> 16);
+	p->data[6] = (uint8_t)(ts >> 8);
+	p->data[7] = (uint8_t)ts;
+	if (q != NULL)
+		memcpy(p->data + 8, q->data + 8, 4);
+	else
+		memset(p->data + 8, 0, 4);
+	if (rtp_parse(p, RTP_HEADER_LEN + len) < 0) {
+		rtp_put(s, idx);
+		return -1;
+	}
+	p->size = (uint16_t)(RTP_HEADER_LEN + len);
+	p->stamp = s->last;
+	p->leg = 0;
+	p->rebuilt = 1;
+	s->win[seq & s->mask] = idx;
+	s->held++;
+	return 0;
+}
+
+/* rebuild what the FEC packets at hand allow, the number of packets rebuilt */
+static int rtp_fec_recover(struct rtp_session *s)
+{
+	struct rtp_fec *f;
+	int i, j, missing, progress = 1, got = 0;
+	uint16_t m, lost = 0, last;
+
+	while (progress) {
+		progress = 0;
+		for (i = 0; i < RTP_FEC_MAX; i++) {
+			f = &s->fec[i];
+			if (!f->used)
+				continue;
+			last = (uint16_t)(f->h.base + (f->h.na - 1) * f->h.offset);
+			/* the stream is past all of it */
+			if ((int16_t)(last - s->expect) < 0) {
+				f->used = 0;
+				continue;
+			}
+			missing = 0;
+			for (j = 0; j < f->h.na && missing < 2; j++) {
+				m = (uint16_t)(f->h.base + j * f->h.offset);
+				if (rtp_fec_find(s, m) < 0) {
+					missing++;
+					lost = m;
+				}
+			}
+			if (missing > 1)
+				continue;
+			/* nothing to rebuild, or the missing one was given up already */
+			if (missing == 1 && (int16_t)(lost - s->expect) >= 0 && (int16_t)(lost - s->expect) < s->window &&
+				rtp_fec_rebuild(s, f, lost) == 0) {
+				got++;
+				progress = 1;
+			}
+			f->used = 0;
+		}
+	}
+	s->fec_recovered += (uint64_t)got;
+	return got;
+}
+
+/* wait for any leg or FEC stream and take what they have queued */
+static int rtp_receive_legs(struct rtp_session *s)
+{
+	struct pollfd pfd[RTP_LEGS + 2];
+	struct timespec now;
+	int i, n, nfds = s->nlegs, got = 0;
+
+	if (s->nlegs == 1 && !s->fec_on)
+		return rtp_receive(s, &s->leg[0], MSG_WAITFORONE);
+	for (i = 0; i < s->nlegs; i++) {
+		pfd[i].fd = s->leg[i].fd;
+		pfd[i].events = POLLIN;
+	}
+	for (i = 0; i < 2; i++) {
+		if (s->fec_fd[i] < 0)
+			continue;
+		pfd[nfds].fd = s->fec_fd[i];
+		pfd[nfds++].events = POLLIN;
+	}
+	/* all silent, time still runs out for a gap */
+	do {
+		n = poll(pfd, (nfds_t)nfds, s->gap_since ? RTP_WIDE_DELAY_MS : -1);
+	} while (n < 0 && errno == EINTR);
+	if (n == 0) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		s->last = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+		return 0;
+	}
+	if (n < 0)
+		return -1;
+	for (i = 0; i < s->nlegs; i++) {
+		if (!(pfd[i].revents & POLLIN))
+			continue;
+		n = rtp_receive(s, &s->leg[i], MSG_DONTWAIT);
+		if (n > 0)
+			got += n;
+	}
+	for (i = s->nlegs; i < nfds; i++) {
+		if (pfd[i].revents & POLLIN)
+			rtp_fec_receive(s, pfd[i].fd);
+	}
+	return got > 0 ? got : (n < 0 && errno != EAGAIN ? -1 : 0);
+}
+
+/* nothing more is waited for at expect */
+static int rtp_give_up(struct rtp_session *s)
+{
+	/* half a window arrived behind the gap, the packet is lost */
+	if (s->held >= s->window / 2 || unlikely(s->free_num == 0))
+		return 1;
+	if (s->window > RTP_WINDOW && s->held > 0) {
+		if (s->gap_since == 0)
+			s->gap_since = s->last;
+		else if (s->last - s->gap_since >= (uint64_t)RTP_WIDE_DELAY_MS * 1000000)
+			return 1;
+	}
+	return 0;
+}
+
+/* seq at expect will not come, move on */
+static void rtp_skip(struct rtp_session *s)
+{
+	rtp_lost(s, 1);
+	/* no leg delivered it, all of them miss it */
+	if (s->nlegs > 1)
+		rtp_leg_slot(s, s->expect);
+	s->expect++;
+}
+
+/* next packet in sequence order, -1 on receive error */
+static int rtp_next(struct rtp_session *s)
+{
+	int idx;
+
+	if (s->cur >= 0) {
+		if (s->fec_on)
+			rtp_hist_put(s, s->cur);
+		else
+			rtp_put(s, s->cur);
+		s->cur = -1;
+	}
+	for (;;) {
+		idx = s->win[s->expect & s->mask];
+		if (idx >= 0) {
+			s->win[s->expect & s->mask] = -1;
+			s->done[s->expect & s->mask] = s->expect;
+			s->held--;
+			s->expect++;
+			s->cur = idx;
+			s->gap_since = 0;
+			if (s->nlegs > 1)
+				s->stats.received++;
+			return idx;
+		}
+		if (unlikely(s->pend_num > 0) && s->held == 0) {
+			rtp_resync(s);
+			continue;
+		}
+		if (unlikely(s->pend_num > 0) || rtp_give_up(s)) {
+			/* only now, a packet that is late or reordered is not rebuilt ahead of itself */
+			if (s->fec_on && s->fec_dirty) {
+				s->fec_dirty = 0;
+				if (rtp_fec_recover(s) > 0)
+					continue;
+			}
+			rtp_skip(s);
+			continue;
+		}
+		if (rtp_receive_legs(s) < 0)
+			return -1;
+	}
+}
+
+static int rtp_open(const char *urlpath)
+{
+	struct url *surl = parse_url_path(urlpath, "rtp");
+	struct url fec;
+	int fd, fec_fds[2], i;
+	if (surl == NULL)
+		return -1;
+	fd = udp_socket(surl);
+	if (fd < 0)
+		return -1;
+	if (surl->fec) {
+		/* columns on port + 2, rows on port + 4 */
+		fec = *surl;
+		for (i = 0; i < 2; i++) {
+			fec.port = surl->port + 2 * (uint32_t)(i + 1);
+			fec_fds[i] = udp_socket(&fec);
+			if (fec_fds[i] < 0) {
+				printf("cannot receive FEC on port %u\n", fec.port);
+				while (i-- > 0)
+					close(fec_fds[i]);
+				close(fd);
+				return -1;
+			}
+		}
+	}
+	if (rtp_session_init(&rtp, &fd, 1, surl->fec ? fec_fds : NULL) < 0) {
+		rtp_session_uninit(&rtp);
+		return -1;
+	}
+	rtp_ops.fd = fd;
+	rtp_ops.block_size = UDP_MAX_DGRAM;
+	return 0;
+}
+
+/* rtp://leg1,rtp://leg2, the scheme may be left out */
+static int hitless_open(const char *names)
+{
+	char buf[sizeof(get_config()->name)], url[sizeof(buf) + 8];
+	char *tok = buf, *next;
+	struct url *surl;
+	int fds[RTP_LEGS], n = 0, i;
+
+	snprintf(buf, sizeof(buf), "%s", names);
+	while (tok != NULL && n < RTP_LEGS) {
+		next = strchr(tok, ',');
+		if (next != NULL)
+			*next++ = '\0';
+		snprintf(url, sizeof(url), "%s%s", strstr(tok, "://") == NULL ? "rtp://" : "", tok);
+		surl = parse_url_path(url, "rtp");
+		if (surl == NULL || (fds[n] = udp_socket(surl)) < 0) {
+			printf("cannot open leg %s\n", url);
+			break;
+		}
+		n++;
+		tok = next;
+	}
+	if (n != RTP_LEGS || tok != NULL) {
+		if (n == RTP_LEGS)
+			printf("hitless input takes %d legs\n", RTP_LEGS);
+		for (i = 0; i < n; i++)
+			close(fds[i]);
+		return -1;
+	}
+	if (rtp_session_init(&rtp, fds, n, NULL) < 0) {
+		rtp_session_uninit(&rtp);
+		return -1;
+	}
+	hitless_ops.fd = fds[0];
+	hitless_ops.block_size = UDP_MAX_DGRAM;
+	return 0;
+}
+
+static int rtp_read(void **ptr, size_t *len)
+{
+	int idx = rtp_next(&rtp);
+	if (unlikely(idx < 0)) {
+		*ptr = NULL;
+		*len = 0;
+		return -1;
+	}
+	*ptr = rtp.pkt[idx].data + rtp.pkt[idx].off;
+	*len = rtp.pkt[idx].len;
+	rtp_ops.stamp = rtp.pkt[idx].stamp;
+	hitless_ops.stamp = rtp.pkt[idx].stamp;
+	return 0;
+}
+
+static int rtp_close(void)
+{
+	rtp_session_uninit(&rtp);
+	rtp_ops.fd = -1;
+	hitless_ops.fd = -1;
+	return 0;
+}
+
+static int64_t rtp_end(void)
+{
+	return 1;
+}
+
+static void rtp_dump_stats(const char *name, struct rtp_stats *st)
+{
+	printf("\n");
+	printf("RTP %s statistics:\n", name);
+	printf("%12s%12s%12s%12s%12s%12s\n", "Received", "Lost", "Reordered", "Duplicate", "Late", "Invalid");
+	printf("%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "\n", st->received, st->lost,
+		   st->reordered, st->duplicate, st->late, st->invalid);
+}
+
+static void rtp_dump_lost(uint64_t lost, struct udp_rx *rx)
+{
+	/* socket drops show up as sequence gaps too */
+	if (lost >= rx->drops)
+		printf("Lost on the network %" PRIu64 ", in the socket buffer %u\n", lost - rx->drops, rx->drops);
+}
+
+static void rtp_dump(void)
+{
+	struct rtp_stats st = rtp.stats;
+
+	if (rtp.nlegs == 0)
+		return;
+	/* a single socket counts its datagrams on its leg */
+	st.received = rtp.leg[0].stats.received;
+	st.invalid = rtp.leg[0].stats.invalid;
+	rtp_dump_stats("input", &st);
+	mdi_dump("input", &rtp.leg[0].mdi);
+	udp_rx_dump(&rtp.leg[0].rx);
+	if (!rtp.fec_on) {
+		rtp_dump_lost(rtp.stats.lost, &rtp.leg[0].rx);
+		return;
+	}
+	printf("\n");
+	printf("FEC %ux%u:\n", rtp.fec_l, rtp.fec_d);
+	printf("%12s%12s%12s%12s%14s\n", "Columns", "Rows", "Invalid", "Recovered", "Unrecoverable");
+	printf("%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%14" PRIu64 "\n", rtp.fec_received[0],
+		   rtp.fec_received[1], rtp.fec_invalid, rtp.fec_recovered, rtp.stats.lost);
+	/* before FEC stepped in */
+	rtp_dump_lost(rtp.stats.lost + rtp.fec_recovered, &rtp.leg[0].rx);
+}
+
+static void hitless_dump(void)
+{
+	char name[16];
+	int i;
+
+	if (rtp.nlegs == 0)
+		return;
+	/* slots the merged stream is past will not hear from a leg any more */
+	for (i = 0; i < rtp.window; i++) {
+		if (rtp.sseq[i] >= 0 && (int16_t)((uint16_t)rtp.sseq[i] - rtp.expect) < 0) {
+			rtp_leg_retire(&rtp, i);
+			rtp.sseq[i] = -1;
+		}
+	}
+	rtp_dump_stats("merged", &rtp.stats);
+	printf("Recovered %" PRIu64 " datagrams missed by one leg\n", rtp.recovered);
+	for (i = 0; i < rtp.nlegs; i++) {
+		snprintf(name, sizeof(name), "leg %d", i + 1);
+		rtp_dump_stats(name, &rtp.leg[i].stats);
+		mdi_dump(name, &rtp.leg[i].mdi);
+		udp_rx_dump(&rtp.leg[i].rx);
+		rtp_dump_lost(rtp.leg[i].stats.lost, &rtp.leg[i].rx);
+	}
+}
+
+static struct io_ops rtp_ops = {
+	.type = IO_RTP,
+	.fd = -1,
+	.open = rtp_open,
+	.read = rtp_read,
+	.close = rtp_close,
+	.end = rtp_end,
+	.dump = rtp_dump,
+};
+
+REGISTER_IO_OPS(rtp, &rtp_ops);
+
+static struct io_ops hitless_ops = {
+	.type = IO_HITLESS,
+	.fd = -1,
+	.open = hitless_open,
+	.read = rtp_read,
+	.close = rtp_close,
+	.end = rtp_end,
+	.dump = hitless_dump,
+};
+
+REGISTER_IO_OPS(hitless, &hitless_ops);
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "io.h"
+#include "shm.h"
+#include "ts.h"
+
+/*
+ * shm://name attaches to a ring a producer process created with
+ * shm_open("/name"), see shm.h for the layout. packets are handed out in
+ * place, the slots of a read go back to the producer on the next read()
+ */
+
+#define SHM_DEFAULT_BLOCK (4 * 1024 * 1024)
+#define SHM_WAIT_MS (100)
+
+_Static_assert(sizeof(struct shm_ring) == 3 * SHM_RING_CACHELINE, "shm ring header layout");
+
+static struct io_ops shm_ops;
+
+static struct {
+	struct shm_ring *ring;
+	uint8_t *data;
+	size_t map_len;
+	uint64_t capacity;
+	uint64_t mask;
+	uint64_t tail; /* local copy, only published on release */
+	uint32_t handed; /* packets of the last read */
+	uint32_t max_pkts; /* per read */
+	int done;
+	uint64_t packets;
+	uint64_t sleeps;
+	uint64_t max_fill;
+} sr;
+
+static long shm_futex(uint32_t *addr, int op, uint32_t val, const struct timespec *ts)
+{
+	return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+static int shm_attach(const char *name)
+{
+	struct stat st;
+	struct shm_ring *r;
+	char path[256];
+	uint64_t need;
+
+	if (strncmp(name, "shm://", 6) == 0)
+		name += 6;
+	if (name[0] == '\0' || strlen(name) + 2 > sizeof(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+
+	shm_ops.fd = shm_open(path, O_RDWR, 0);
+	if (shm_ops.fd < 0) {
+		printf("shm: cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(shm_ops.fd, &st) < 0 || (size_t)st.st_size < sizeof(struct shm_ring))
+		return -1;
+	sr.map_len = (size_t)st.st_size;
+	r = mmap(NULL, sr.map_len, PROT_READ | PROT_WRITE, MAP_SHARED, shm_ops.fd, 0);
+	if (r == MAP_FAILED)
+		return -1;
+	sr.ring = r;
+
+	/* magic is written last, the rest of the header is visible after it */
+	if (__atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || r->version != SHM_RING_VERSION) {
+		printf("shm: %s is not a ts ring\n", path);
+		return -1;
+	}
+	need = r->data_offset + (uint64_t)r->capacity * r->packet_size;
+	if ((r->packet_size != TS_PACKET_SIZE && r->packet_size != TS_DVHS_PACKET_SIZE &&
+		 r->packet_size != TS_FEC_PACKET_SIZE) ||
+		r->capacity == 0 || (r->capacity & (r->capacity - 1)) != 0 || r->data_offset < sizeof(struct shm_ring) ||
+		need > sr.map_len) {
+		printf("shm: bad ring header in %s\n", path);
+		return -1;
+	}
+	sr.data = (uint8_t *)r + r->data_offset;
+	sr.capacity = r->capacity;
+	sr.mask = r->capacity - 1;
+	return 0;
+}
+
+static int shm_close(void);
+
+static int shm_open_ring(const char *name)
+{
+	struct tsa_config *tsaconf = get_config();
+
+	if (name == NULL)
+		return -1;
+	memset(&sr, 0, sizeof(sr));
+	if (shm_attach(name) < 0) {
+		shm_close();
+		return -1;
+	}
+	shm_ops.block_size = SHM_DEFAULT_BLOCK;
+	if (tsaconf->mem)
+		shm_ops.block_size = (size_t)tsaconf->mem * 1024 * 1024;
+	sr.max_pkts = (uint32_t)(shm_ops.block_size / sr.ring->packet_size);
+	if (sr.max_pkts == 0)
+		sr.max_pkts = 1;
+	sr.tail = __atomic_load_n(&sr.ring->tail, __ATOMIC_ACQUIRE);
+	shm_ops.offset = 0;
+	madvise(sr.data, (size_t)sr.ring->capacity * sr.ring->packet_size, MADV_WILLNEED);
+	return 0;
+}
+
+/* give the slots of the last read back to the producer */
+static void shm_release(void)
+{
+	struct shm_ring *r = sr.ring;
+
+	if (sr.handed == 0)
+		return;
+	sr.tail += sr.handed;
+	sr.handed = 0;
+	__atomic_store_n(&r->tail, sr.tail, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->prod_wait, __ATOMIC_SEQ_CST)) {
+		__atomic_add_fetch(&r->space_seq, 1, __ATOMIC_SEQ_CST);
+		shm_futex(&r->space_seq, FUTEX_WAKE, 1, NULL);
+	}
+}
+
+/* sleep until head moves past tail, -1 when the ring is closed and empty */
+static int shm_wait(uint64_t *head)
+{
+	const struct timespec ts = { .tv_sec = 0, .tv_nsec = SHM_WAIT_MS * 1000000L };
+	struct shm_ring *r = sr.ring;
+	uint32_t seq;
+
+	for (;;) {
+		*head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (*head != sr.tail)
+			return 0;
+		if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE))
+			return -1;
+		/* announce the wait before the last look at head, the producer wakes after its store */
+		seq = __atomic_load_n(&r->data_seq, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&r->cons_wait, 1, __ATOMIC_SEQ_CST);
+		*head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+		if (*head == sr.tail && !__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST)) {
+			sr.sleeps++;
+			shm_futex(&r->data_seq, FUTEX_WAIT, seq, &ts);
+		}
+		__atomic_store_n(&r->cons_wait, 0, __ATOMIC_RELAXED);
+	}
+}
+
+static int shm_read(void **ptr, size_t *len)
+{
+	struct shm_ring *r = sr.ring;
+	uint64_t head, avail, idx;
+	uint32_t n;
+
+	shm_release();
+	if (unlikely(shm_wait(&head) < 0)) {
+		sr.done = 1;
+		*ptr = NULL;
+		*len = 0;
+		return -1;
+	}
+
+	avail = head - sr.tail;
+	if (avail > sr.max_fill)
+		sr.max_fill = avail;
+	/* contiguous slots only, the rest follows after the wrap */
+	idx = sr.tail & sr.mask;
+	n = avail < sr.max_pkts ? (uint32_t)avail : sr.max_pkts;
+	if (idx + n > r->capacity)
+		n = (uint32_t)(r->capacity - idx);
+	sr.handed = n;
+	sr.packets += n;
+
+	shm_ops.ptr = sr.data + idx * r->packet_size;
+	shm_ops.offset += (uint64_t)n * r->packet_size;
+	*ptr = shm_ops.ptr;
+	*len = (size_t)n * r->packet_size;
+	return 0;
+}
+
+static int shm_close(void)
+{
+	if (sr.ring != NULL) {
+		shm_release();
+		munmap(sr.ring, sr.map_len);
+		sr.ring = NULL;
+	}
+	if (shm_ops.fd >= 0)
+		close(shm_ops.fd);
+	shm_ops.fd = -1;
+	shm_ops.ptr = NULL;
+	return 0;
+}
+
+static int64_t shm_end(void)
+{
+	return sr.done ? 0 : 1;
+}
+
+static void shm_dump(void)
+{
+	printf("\n");
+	printf("Shared memory ring:\n");
+	printf("%12s%14s%12s%12s\n", "Capacity", "Packets", "Sleeps", "Max fill");
+	printf("%12" PRIu64 "%14" PRIu64 "%12" PRIu64 "%12" PRIu64 "\n", sr.capacity, sr.packets, sr.sleeps, sr.max_fill);
+}
+
+static struct io_ops shm_ops = {
+	.type = IO_SHM,
+	.fd = -1,
+	.open = shm_open_ring,
+	.read = shm_read,
+	.close = shm_close,
+	.end = shm_end,
+	.dump = shm_dump,
+};
+
+REGISTER_IO_OPS(shm, &shm_ops);
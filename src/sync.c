@@ -0,0 +1,59 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "sync.h"
+#include "ts.h"
+
+/*
+ * sync byte search, 64 bytes per step with vector extensions like
+ * fec_xor(): SSE2 on any x86-64, an AVX2 clone when the cpu has it and
+ * plain scalar code elsewhere. payload bytes are 0x47 about once in 256,
+ * so whole steps without one are the rule while sync is lost
+ */
+typedef uint8_t sync_vec __attribute__((vector_size(32)));
+typedef uint64_t sync_vec64 __attribute__((vector_size(32)));
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+size_t ts_sync_find(const uint8_t *buf, size_t len)
+{
+	const sync_vec sync = (sync_vec){ 0 } + TS_SYNC_BYTE;
+	sync_vec a, b;
+	sync_vec64 m;
+	size_t i = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		memcpy(&a, buf + i, 32);
+		memcpy(&b, buf + i + 32, 32);
+		m = (sync_vec64)((a == sync) | (b == sync));
+		if (m[0] | m[1] | m[2] | m[3])
+			break;
+	}
+	for (; i < len; i++) {
+		if (buf[i] == TS_SYNC_BYTE)
+			return i;
+	}
+	return len;
+}
+
+int ts_sync_lock(const uint8_t *buf, size_t len, size_t stride, size_t *off)
+{
+	size_t span = (TS_SYNC_LOCK - 1) * stride, p = 0, k;
+
+	for (;;) {
+		p += ts_sync_find(buf + p, len - p);
+		if (p + span >= len) {
+			*off = p;
+			return 0;
+		}
+		for (k = 1; k < TS_SYNC_LOCK && buf[p + k * stride] == TS_SYNC_BYTE; k++)
+			;
+		if (k == TS_SYNC_LOCK) {
+			*off = p;
+			return 1;
+		}
+		p++;
+	}
+}
@@ -3,7 +3,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bitrate.h"
 #include "error.h"
+#include "etr290.h"
+#include "pcr.h"
 #include "pes.h"
 #include "filter.h"
 #include "table.h"
@@ -355,6 +358,11 @@ void dump_tables(void)
 	if (psi.stats.eit_other_sections && (tsaconf->tables & EIT_SHOW))
 		dump_eit(&psi.eit_other);
 
+	/* with -d, on stdout these replace the tables dump_ts_info() prints */
+	if (tsaconf->detail) {
+		dump_bitrate_res();
+		dump_pcr_res();
+	}
 	res_close();
 }
 
@@ -748,11 +756,26 @@ int parse_tsdt(uint8_t *pbuf, uint16_t buf_size, tsdt_t *pTSDT)
 	return 0;
 }
 
+/* a parsed PMT other than pmt has pid as its PCR_PID */
+static bool pcr_pid_in_use(uint16_t pid, const pmt_t *pmt)
+{
+	int i;
+
+	for (i = 0; i < 0x2000; i++) {
+		if (!(psi.pmt_bitmap[i / 64] & ((uint64_t)1 << (i % 64))) || &psi.pmt[i] == pmt)
+			continue;
+		if (psi.pmt[i].program_number != 0 && psi.pmt[i].PCR_PID == pid)
+			return true;
+	}
+	return false;
+}
+
 int parse_pmt(uint8_t *pbuf, uint16_t buf_size, pmt_t *pPMT)
 {
 	int16_t section_len = 0;
 	uint8_t *pdata = NULL;
 	struct es_node *pn = NULL, *next = NULL;
+	uint16_t old_pcr_pid;
 
 	int ret = parse_section_header(pbuf, buf_size, &pPMT->pmt_header);
 	if (ret != 0)
@@ -771,6 +794,8 @@ int parse_pmt(uint8_t *pbuf, uint16_t buf_size, pmt_t *pPMT)
 	if (!list_empty(&(pPMT->list)))
 		free_descriptors(&(pPMT->list));
 
+	/* program_number is 0 until the first version */
+	old_pcr_pid = pPMT->program_number != 0 ? pPMT->PCR_PID : NULL_PID;
 	section_len = pPMT->pmt_header.section_length;
 
 	// Transport Stream ID
@@ -780,6 +805,10 @@ int parse_pmt(uint8_t *pbuf, uint16_t buf_size, pmt_t *pPMT)
 	pdata = pPMT->pmt_header.private_data_byte;
 
 	pPMT->PCR_PID = TS_READ16(pdata) & 0x1FFF;
+	/* a new version may move the PCR, the old PID is no longer parsed for it */
+	if (old_pcr_pid != NULL_PID && old_pcr_pid != pPMT->PCR_PID && !pcr_pid_in_use(old_pcr_pid, pPMT))
+		filter_set_pcr(old_pcr_pid, 0);
+	filter_set_pcr(pPMT->PCR_PID, 1);
 	pdata += 2;
 	section_len -= 2;
 	pPMT->program_info_length = TS_READ16(pdata) & 0x0FFF;
@@ -799,6 +828,7 @@ int parse_pmt(uint8_t *pbuf, uint16_t buf_size, pmt_t *pPMT)
 		pdata += 1;
 		pn->elementary_PID = TS_READ16(pdata) & 0x1FFF;
 		register_pes_ops(pn->elementary_PID);
+		filter_set_pts(pn->elementary_PID, 1);
 		pdata += 2;
 		pn->ES_info_length = TS_READ16(pdata) & 0x0FFF;
 		pdata += 2;
@@ -1060,10 +1090,36 @@ static int parse_tot(uint8_t *pbuf, uint16_t buf_size, tot_t *pTOT)
 	return 0;
 }
 
+/* ECM and EMM PIDs of the CA_descriptors in a descriptor list, program 0 for the CAT */
+static void refer_ca_pids(struct list_head *list, uint16_t from, uint16_t program)
+{
+	descriptor_t *dr = NULL;
+	uint16_t ca_pid;
+
+	list_for_each(list, dr, n)
+	{
+		if (dr->tag != dr_CA)
+			continue;
+		ca_pid = ((CA_descriptor_t *)dr)->CA_PID;
+		etr_refer(ca_pid, from, ETR_REF_CA);
+		if (program)
+			bitrate_program(ca_pid, program);
+	}
+}
+
 static int pat_proc(__attribute__((unused)) uint16_t pid, uint8_t *pkt, uint16_t len)
 {
+	struct program_node *pn = NULL;
+
 	psi.stats.pat_sections ++;
-	parse_pat(pkt, len, &psi.pat);
+	if (parse_pat(pkt, len, &psi.pat) != 0)
+		return 0;
+	etr_unrefer(PAT_PID);
+	list_for_each(&psi.pat.h, pn, n)
+	{
+		if (pn->program_number != 0)
+			etr_refer(pn->program_map_PID, PAT_PID, ETR_REF_PMT);
+	}
 	return 0;
 }
 
@@ -1076,6 +1132,8 @@ static int cat_proc(__attribute__((unused)) uint16_t pid, uint8_t *pkt, uint16_t
 	list_for_each(&psi.cat.list, ca, n) {
 		psi.ca_num ++;
 	}
+	etr_unrefer(CAT_PID);
+	refer_ca_pids(&psi.cat.list, CAT_PID, 0);
 	return 0;
 }
 
@@ -1088,7 +1146,24 @@ static int tsdt_proc(__attribute__((unused)) uint16_t pid, uint8_t *pkt, uint16_
 
 static int pmt_proc(uint16_t pid, uint8_t *pkt, uint16_t len)
 {
-	parse_pmt(pkt, len, &(psi.pmt[pid]));
+	pmt_t *pmt = &psi.pmt[pid];
+	struct es_node *pn = NULL;
+
+	if (parse_pmt(pkt, len, pmt) != 0)
+		return 0;
+	etr_unrefer(pid);
+	etr_refer(pmt->PCR_PID, pid, ETR_REF_PCR);
+	bitrate_program_reset(pmt->program_number);
+	refer_ca_pids(&pmt->list, pid, pmt->program_number);
+	bitrate_program(pid, pmt->program_number);
+	bitrate_program(pmt->PCR_PID, pmt->program_number);
+	pcr_program(pmt->PCR_PID, pmt->program_number);
+	list_for_each(&pmt->h, pn, n)
+	{
+		etr_refer(pn->elementary_PID, pid, ETR_REF_ES);
+		bitrate_program(pn->elementary_PID, pmt->program_number);
+		refer_ca_pids(&pn->list, pid, pmt->program_number);
+	}
 	return 0;
 }
 
@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "frame.h"
+#include "io.h"
+#include "rtp.h"
+#include "ts.h"
+
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+/*
+ * capture from a TPACKET_V3 ring: the kernel fills whole blocks of frames,
+ * a classic BPF filter keeps everything but the watched UDP flow out of the
+ * ring. UDP flows found in the ring are demultiplexed into a flow table,
+ * payloads of the selected one are handed out straight from the ring block
+ * (RTP headers skipped). the block goes back to the kernel once all of its
+ * frames were handed out.
+ *
+ * tpacket://eth0/239.1.1.1:1234 watches one flow, tpacket://eth0 takes the
+ * first flow carrying TS. a list of urls runs one worker per flow.
+ */
+
+#define TPACKET_BLOCK_SIZE (1 << 22)
+#define TPACKET_BLOCK_NR (64)
+#define TPACKET_FRAME_SIZE (2048)
+#define TPACKET_RETIRE_MS (10)
+
+static struct io_ops tpacket_ops;
+
+static struct {
+	uint8_t *map;
+	size_t map_len;
+	unsigned int block; /* next block to walk */
+	struct tpacket_block_desc *bd; /* block being walked, NULL if none */
+	uint8_t *ppd; /* next frame in bd */
+	uint32_t left; /* frames left in bd */
+	uint32_t daddr; /* selected flow, network order */
+	uint16_t dport;
+	int locked; /* flow selected */
+	uint64_t drops;
+	struct flow_table flows;
+} tp;
+
+static int tpacket_parse_url(const char *urlpath, char *ifname, size_t size)
+{
+	char path[256], *dst, *colon;
+	if (strncmp(urlpath, "tpacket://", 10) != 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s", urlpath + 10);
+	tp.daddr = 0;
+	tp.dport = 0;
+	dst = strchr(path, '/');
+	if (dst != NULL) {
+		*dst++ = '\0';
+		colon = strchr(dst, ':');
+		if (colon != NULL) {
+			*colon = '\0';
+			tp.dport = (uint16_t)atoi(colon + 1);
+		}
+		tp.daddr = inet_addr(dst);
+	}
+	if (path[0] == '\0' || strlen(path) >= size)
+		return -1;
+	memcpy(ifname, path, strlen(path) + 1);
+	return 0;
+}
+
+/* untagged IPv4 UDP to daddr:dport, zero address or port match anything */
+static int tpacket_attach_filter(int fd)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 8),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 30),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(tp.daddr), 0, 4),
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, tp.dport, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFF),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+
+	if (tp.daddr == 0)
+		code[5] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0);
+	if (tp.dport == 0)
+		code[8] = (struct sock_filter)BPF_STMT(BPF_JMP | BPF_JA, 0);
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+static int tpacket_open(const char *urlpath)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	char ifname[IF_NAMESIZE];
+	int fd;
+
+	memset(&tp, 0, sizeof(tp));
+	if (tpacket_parse_url(urlpath, ifname, sizeof(ifname)) < 0)
+		return -1;
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (fd < 0)
+		return -1;
+	tpacket_ops.fd = fd;
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &(int){ TPACKET_V3 }, sizeof(int)) < 0)
+		goto fail;
+#ifdef PACKET_IGNORE_OUTGOING
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &(int){ 1 }, sizeof(int));
+#endif
+	if (tpacket_attach_filter(fd) < 0)
+		goto fail;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = TPACKET_BLOCK_SIZE;
+	req.tp_block_nr = TPACKET_BLOCK_NR;
+	req.tp_frame_size = TPACKET_FRAME_SIZE;
+	req.tp_frame_nr = (TPACKET_BLOCK_SIZE / TPACKET_FRAME_SIZE) * TPACKET_BLOCK_NR;
+	req.tp_retire_blk_tov = TPACKET_RETIRE_MS;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+		goto fail;
+	tp.map_len = (size_t)TPACKET_BLOCK_SIZE * TPACKET_BLOCK_NR;
+	tp.map = mmap(NULL, tp.map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (tp.map == MAP_FAILED) {
+		tp.map = NULL;
+		goto fail;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = (int)if_nametoindex(ifname);
+	if (sll.sll_ifindex == 0 || bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+		goto fail;
+
+	tp.locked = tp.daddr != 0 && tp.dport != 0;
+	tpacket_ops.block_size = TPACKET_FRAME_SIZE;
+	return 0;
+
+fail:
+	if (tp.map != NULL)
+		munmap(tp.map, tp.map_len);
+	tp.map = NULL;
+	close(fd);
+	tpacket_ops.fd = -1;
+	return -1;
+}
+
+static void tpacket_release(void)
+{
+	__atomic_store_n(&tp.bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	tp.bd = NULL;
+	tp.block = (tp.block + 1) % TPACKET_BLOCK_NR;
+}
+
+static int tpacket_next_block(void)
+{
+	struct tpacket_block_desc *bd = (struct tpacket_block_desc *)(tp.map + (size_t)tp.block * TPACKET_BLOCK_SIZE);
+	struct pollfd pfd = { .fd = tpacket_ops.fd, .events = POLLIN | POLLERR };
+
+	while (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return -1;
+	}
+	tp.bd = bd;
+	tp.ppd = (uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt;
+	tp.left = bd->hdr.bh1.num_pkts;
+	return 0;
+}
+
+static int tpacket_read(void **ptr, size_t *len)
+{
+	struct tpacket3_hdr *hdr;
+	struct sockaddr_ll *sll;
+	struct flow_key key;
+	struct flow_stat *f;
+	const uint8_t *payload;
+	size_t plen;
+	uint16_t seq, off, rlen;
+
+	for (;;) {
+		if (tp.bd == NULL && tpacket_next_block() < 0) {
+			*ptr = NULL;
+			*len = 0;
+			return -1;
+		}
+		while (tp.left) {
+			hdr = (struct tpacket3_hdr *)tp.ppd;
+			tp.ppd += hdr->tp_next_offset;
+			tp.left--;
+			sll = (struct sockaddr_ll *)((uint8_t *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+			if (sll->sll_pkttype == PACKET_OUTGOING)
+				continue;
+			if (frame_udp_payload((uint8_t *)hdr + hdr->tp_mac, hdr->tp_snaplen, &key, &payload, &plen) < 0)
+				continue;
+			f = flow_lookup(&tp.flows, &key);
+			if (f != NULL) {
+				f->pkts++;
+				f->bytes += plen;
+			}
+			if (unlikely(!tp.locked)) {
+				/* no flow given, stay on the first one carrying TS */
+				if (plen == 0 || (payload[0] != TS_SYNC_BYTE && rtp_parse_header(payload, plen, &seq, &off, &rlen) < 0))
+					continue;
+				tp.daddr = key.daddr;
+				tp.dport = key.dport;
+				tp.locked = 1;
+			}
+			if (key.daddr != tp.daddr || key.dport != tp.dport || plen == 0)
+				continue;
+			if (payload[0] != TS_SYNC_BYTE && rtp_parse_header(payload, plen, &seq, &off, &rlen) == 0) {
+				payload += off;
+				plen = rlen;
+			}
+			*ptr = (void *)payload;
+			*len = plen;
+			return 0;
+		}
+		tpacket_release();
+	}
+}
+
+static int tpacket_close(void)
+{
+	if (tp.map != NULL)
+		munmap(tp.map, tp.map_len);
+	tp.map = NULL;
+	tp.bd = NULL;
+	if (tpacket_ops.fd >= 0)
+		close(tpacket_ops.fd);
+	tpacket_ops.fd = -1;
+	return 0;
+}
+
+static int64_t tpacket_end(void)
+{
+	return 1;
+}
+
+static void tpacket_dump(void)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t slen = sizeof(st);
+	struct flow_key sel = { .family = AF_INET, .daddr = tp.daddr, .dport = tp.dport };
+	char title[64];
+
+	if (tpacket_ops.fd >= 0 && getsockopt(tpacket_ops.fd, SOL_PACKET, PACKET_STATISTICS, &st, &slen) == 0)
+		tp.drops += st.tp_drops;
+	snprintf(title, sizeof(title), "Capture flows (ring drops %" PRIu64 ")", tp.drops);
+	flow_table_dump(title, &tp.flows, tp.locked ? &sel : NULL);
+}
+
+static struct io_ops tpacket_ops = {
+	.type = IO_TPACKET,
+	.fd = -1,
+	.open = tpacket_open,
+	.read = tpacket_read,
+	.close = tpacket_close,
+	.end = tpacket_end,
+	.dump = tpacket_dump,
+};
+
+REGISTER_IO_OPS(tpacket, &tpacket_ops);
+
+#endif
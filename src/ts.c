@@ -1,10 +1,17 @@
+#define _GNU_SOURCE
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
+#include "bitrate.h"
+#include "etr290.h"
 #include "filter.h"
 #include "io.h"
+#include "pcr.h"
+#include "result.h"
+#include "sync.h"
 #include "table.h"
 #include "ts.h"
 #include "utils.h"
@@ -134,23 +141,19 @@ int16_t section_preproc(uint16_t pid, uint8_t *pkt, uint16_t len, uint8_t **buff
 	return -1;
 }
 
-struct pid_ops {
-	uint16_t pid;
-	uint64_t pkts_in;
-	uint64_t error_in;
-	uint64_t bits_in;
-	uint64_t pcr;
-	uint64_t bitrate;
-};
-
 struct pid_ops pid_dev[MAX_TS_PID_NUM];
 
+/* input of the running analysis, its stamp dates the errors and PCRs */
+static struct io_ops *ts_ops;
+
+static uint64_t ts_stamp(uint64_t offset);
+
 uint64_t calc_pcr_clock(pcr_clock pcr)
 {
 	return pcr.program_clock_reference_base * 300 + pcr.program_clock_reference_extension;
 }
 
-int ts_adaptation_field_proc(uint8_t *data, uint8_t len)
+int ts_adaptation_field_proc(uint16_t pid, uint8_t *data, uint8_t len, uint64_t offset)
 {
 	ts_adaptation_field adapt;
 	pcr_clock pcr, opcr;
@@ -168,15 +171,22 @@ int ts_adaptation_field_proc(uint8_t *data, uint8_t len)
 	l -= 1;
 
 	if (adapt.PCR_flag) {
+		if (l < 6)
+			return -1;
 		pcr.program_clock_reference_base = (((uint64_t)TS_READ32(ptr) << 1) | ptr[4] >> 7);
 		ptr += 4;
 		l -= 4;
 		pcr.program_clock_reference_extension = (TS_READ16(ptr) & 0x1FF);
 		ptr += 2;
 		l -= 2;
-		// printf("clock %lu\n",calc_pcr_clock(pcr));
+		pid_dev[pid].pcr = calc_pcr_clock(pcr);
+		etr_pcr(pid, pid_dev[pid].pcr, adapt.discontinuity_indicator, offset);
+		bitrate_pcr(pid, pid_dev[pid].pcr, adapt.discontinuity_indicator, offset);
+		pcr_sample(pid, pid_dev[pid].pcr, adapt.discontinuity_indicator, offset, ts_stamp(offset));
 	}
 	if (adapt.OPCR_flag) {
+		if (l < 6)
+			return -1;
 		opcr.program_clock_reference_base = (((uint64_t)TS_READ32(ptr) << 1) | ptr[4] >> 7);
 		ptr += 4;
 		l -= 4;
@@ -207,83 +217,595 @@ int ts_adaptation_field_proc(uint8_t *data, uint8_t len)
 	return 0;
 }
 
-int ts_proc(uint8_t *data, uint8_t len)
+/*
+ * headers are decoded up to TS_BATCH at a time into one array per field:
+ * one 32-bit big endian load per packet, then the field extraction and the
+ * sync byte check run over whole arrays and vectorize. the per PID
+ * counters are updated from the arrays before any payload is looked at
+ */
+#define TS_BATCH (64)
+
+/* continuity state of a PID, see ts_count_batch() */
+#define CC_NEXT (0x0F)
+#define CC_SEEN (0x10)
+#define CC_DUP (0x20)
+#define CC_NO_PAYLOAD (0x80)
+#define CC_NULL (0xFF)
+
+struct ts_batch {
+	uint32_t word[TS_BATCH];
+	uint16_t pid[TS_BATCH];
+	uint8_t tei[TS_BATCH];
+	uint8_t pusi[TS_BATCH];
+	uint8_t sc[TS_BATCH];
+	uint8_t afc[TS_BATCH];
+	uint8_t cc[TS_BATCH];
+	uint8_t cc_want[TS_BATCH]; /* continuity state that lets the packet pass */
+	uint8_t cc_pass[TS_BATCH]; /* and the state after it */
+};
+
+/* packets in a row, out of n, that start with a sync byte */
+static inline __attribute__((always_inline)) size_t ts_decode_batch(const uint8_t *buf, size_t n, size_t stride,
+																	 struct ts_batch *b)
 {
-	ts_header head;
-	uint8_t psi_or_pes = 1;
-	uint8_t *ptr = data;
+	uint32_t bad = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		b->word[i] = TS_READ32(buf + i * stride);
+	for (i = 0; i < n; i++)
+		bad |= (b->word[i] >> 24) ^ TS_SYNC_BYTE;
+	if (unlikely(bad)) {
+		for (i = 0; (b->word[i] >> 24) == TS_SYNC_BYTE; i++)
+			;
+		n = i;
+	}
+	for (i = 0; i < n; i++) {
+		uint32_t w = b->word[i];
+		b->tei[i] = (uint8_t)((w >> 23) & 0x1);
+		b->pusi[i] = (uint8_t)((w >> 22) & 0x1);
+		b->pid[i] = (uint16_t)((w >> 8) & 0x1FFF);
+		b->sc[i] = (uint8_t)((w >> 6) & 0x3);
+		b->afc[i] = (uint8_t)((w >> 4) & 0x3);
+		b->cc[i] = (uint8_t)(w & 0xF);
+	}
+	for (i = 0; i < n; i++) {
+		uint8_t cc = b->cc[i], payload = b->afc[i] & ADAPT_NO_FIELD;
+		b->cc_want[i] = b->pid[i] == NULL_PID ? CC_NULL : (payload ? CC_SEEN : CC_NO_PAYLOAD) | cc;
+		b->cc_pass[i] = b->pid[i] == NULL_PID ? CC_NULL : CC_SEEN | ((cc + 1) & CC_NEXT);
+	}
+	return n;
+}
+
+/*
+ * continuity counter check (ISO 13818-1 2.4.3.3). the state of a PID is
+ * one byte: the counter its next packet with payload should carry, whether
+ * one was seen yet and whether the last one was already sent twice. the
+ * batch decoder turns each header into the one state that lets it pass, so
+ * the hot loop compares a byte. anything else, adaptation only packets and
+ * the null PID aside, goes to ts_cc_slow() with the error counts. the
+ * ADAPT_NO_FIELD bit of adaptation_field_control is set when there is payload
+ */
+static uint8_t cc_state[MAX_TS_PID_NUM] = { [NULL_PID] = CC_NULL };
+
+struct cc_errors {
+	uint64_t errors;
+	uint64_t dups;
+	uint64_t lost; /* packets missing between the counters, modulo 16 */
+	uint64_t first_at;
+	uint64_t last_at;
+	uint64_t first_time;
+	uint64_t last_time;
+};
+
+static struct cc_errors cc_err[MAX_TS_PID_NUM];
+static int cc_time_arrival; /* the error times are arrival stamps, else stream time since the first PCR */
+
+#define TS_NO_TIME UINT64_MAX
+
+/* arrival time of an error, stream time where the input has none, TS_NO_TIME before the first PCR */
+static uint64_t ts_error_time(uint64_t offset)
+{
+	uint64_t t;
+
+	if (ts_ops && ts_ops->stamp) {
+		cc_time_arrival = 1;
+		return ts_stamp(offset);
+	}
+	if (etr_pcr_time(offset, &t) < 0)
+		return TS_NO_TIME;
+	return t;
+}
+
+static void ts_cc_error(struct cc_errors *e, uint64_t offset)
+{
+	uint64_t t = ts_error_time(offset);
+
+	if (e->errors == 0) {
+		e->first_at = offset;
+		e->first_time = t;
+	}
+	e->errors++;
+	e->last_at = offset;
+	e->last_time = t;
+	etr_error(ETR_CC, offset);
+}
+
+static __attribute__((noinline)) void ts_cc_slow(uint16_t pid, const uint8_t *pkt, uint8_t afc, uint8_t cc,
+												 uint64_t offset)
+{
+	uint8_t st = cc_state[pid], next = st & CC_NEXT;
+	struct cc_errors *e = &cc_err[pid];
+
+	if (st == 0) {
+		etr_new_pid(pid);
+		bitrate_new_pid(pid);
+	}
+
+	/* discontinuity_indicator: any counter is fine from this packet on */
+	if ((afc & ADAPT_ONLY) && pkt[4] > 0 && (pkt[5] & 0x80)) {
+		cc_state[pid] = (afc & ADAPT_NO_FIELD) ? CC_SEEN | ((cc + 1) & CC_NEXT) : 0;
+		return;
+	}
+	/* the counter does not count packets without payload */
+	if (!(afc & ADAPT_NO_FIELD))
+		return;
+	if (!(st & CC_SEEN) || cc == next) {
+		cc_state[pid] = CC_SEEN | ((cc + 1) & CC_NEXT);
+		return;
+	}
+	if (cc == ((next - 1) & CC_NEXT)) {
+		/* one duplicate is legal, a third copy is not */
+		if (st & CC_DUP) {
+			ts_cc_error(e, offset);
+		} else {
+			e->dups++;
+			cc_state[pid] = st | CC_DUP;
+		}
+		return;
+	}
+	ts_cc_error(e, offset);
+	e->lost += (cc - next) & CC_NEXT;
+	if (ts_ops->loss != NULL)
+		ts_ops->loss((cc - next) & CC_NEXT);
+	cc_state[pid] = CC_SEEN | ((cc + 1) & CC_NEXT);
+}
+
+/* per PID counters of n decoded packets, packet i at buf + i * stride and stream offset + i * stride */
+static inline __attribute__((always_inline)) void ts_count_batch(const struct ts_batch *b, size_t n,
+																  const uint8_t *buf, size_t stride, uint64_t offset)
+{
+	uint16_t pid;
+	uint8_t flagged = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		pid = b->pid[i];
+		pid_dev[pid].pkts_in++;
+		pid_dev[pid].error_in += b->tei[i];
+		flagged |= b->tei[i] | b->sc[i];
+		if (likely(cc_state[pid] == b->cc_want[i])) {
+			cc_state[pid] = b->cc_pass[i];
+			continue;
+		}
+		/* a header with transport_error_indicator set is not to be trusted */
+		if (!b->tei[i])
+			ts_cc_slow(pid, buf + i * stride, b->afc[i], b->cc[i], offset + i * stride);
+	}
+	if (unlikely(flagged)) {
+		for (i = 0; i < n; i++) {
+			if (b->tei[i])
+				etr_error(ETR_TRANSPORT, offset + i * stride);
+			if (b->sc[i])
+				etr_scrambled(b->pid[i], offset + i * stride);
+		}
+	}
+}
+
+/* everything past the header of packet i of a decoded batch, as far as the PID's action asks for */
+static void ts_payload(uint8_t *data, uint8_t len, const struct ts_batch *b, size_t i, uint64_t offset)
+{
+	uint16_t pid = b->pid[i];
+	uint8_t act = filter_action[pid];
+	uint8_t *ptr = data + 4;
+	uint8_t afl;
 	int16_t sec_len = -1;
 	uint8_t *pbuf = NULL;
-	if (unlikely(ptr == NULL))
-		return -1;
-	if (unlikely(ptr[0] != TS_SYNC_BYTE))
-		return -1;
 
-	ptr += 1;
-	head.PID = TS_READ16(ptr) & 0x1FFF;
-	head.transport_error_indicator = TS_READ8(ptr) >> 7;
-	head.payload_unit_start_indicator = TS_READ8(ptr) >> 6;
-	ptr += 2;
-	head.adaptation_field_control = (TS_READ8(ptr) >> 4) & 0x3;
-	head.continuity_counter = TS_READ8(ptr) & 0x3;
-	ptr += 1;
+	if (act == FILTER_ACT_COUNT)
+		return;
 	len -= 4;
 
-	pid_dev[head.PID].pkts_in++;
-
-	if (head.adaptation_field_control == ADAPT_ONLY || head.adaptation_field_control == ADAPT_BOTH) {
-		ts_adaptation_field adapt;
-		adapt.adaptation_field_length = TS_READ8(ptr);
+	if (b->afc[i] == ADAPT_ONLY || b->afc[i] == ADAPT_BOTH) {
+		afl = TS_READ8(ptr);
 		ptr += 1;
-		ts_adaptation_field_proc(ptr, adapt.adaptation_field_length);
-		ptr += adapt.adaptation_field_length;
 		len -= 1;
-		len -= adapt.adaptation_field_length;
-		// TODO
+		if (unlikely(afl > len))
+			return;
+		if ((act & FILTER_ACT_PCR) && afl > 0)
+			ts_adaptation_field_proc(pid, ptr, afl, offset);
+		ptr += afl;
+		len -= afl;
 	}
+	if ((act & FILTER_ACT_PTS) && b->pusi[i] && b->sc[i] == 0 && (b->afc[i] & ADAPT_NO_FIELD))
+		etr_pes(pid, ptr, len, offset);
+	if (!(act & (FILTER_ACT_SECTION | FILTER_ACT_PES)))
+		return;
 
-	if (head.transport_error_indicator == 1) {
-		pid_dev[head.PID].error_in++;
-	}
+	sec_len = section_preproc(pid, ptr, len, &pbuf, b->pusi[i], b->cc[i], (act & FILTER_ACT_SECTION) ? 0 : 1);
+	if (sec_len == -1)
+		return;
+	if ((act & FILTER_ACT_SECTION) && etr_section(pid, pbuf, (uint16_t)sec_len, offset) < 0)
+		return;
 
-	if (head.PID == NULL_PID) {
+	/*use filter to process a section*/
+	filter_proc(pid, pbuf, sec_len);
+}
+
+/* one packet starting at stream offset */
+static int ts_proc_at(uint8_t *data, uint8_t len, uint64_t offset)
+{
+	struct ts_batch b;
+
+	if (unlikely(data == NULL))
+		return -1;
+	if (unlikely(data[0] != TS_SYNC_BYTE))
+		return -1;
+	ts_decode_batch(data, 1, 0, &b);
+	ts_count_batch(&b, 1, data, len, offset);
+	ts_payload(data, len, &b, 0, offset);
+	return 0;
+}
+
+int ts_proc(uint8_t *data, uint8_t len)
+{
+	return ts_proc_at(data, len, 0);
+}
+
+/*
+ * packet alignment across reads. locked: packets are taken stride apart and
+ * one bad sync byte costs only its packet, two in a row lose sync. lost:
+ * bytes are searched for TS_SYNC_LOCK sync bytes in a row, the bytes that
+ * cannot be ruled out before the end of a read are carried to the next one
+ */
+#define TS_SYNC_EVENTS (16)
+
+static struct {
+	int locked;
+	uint64_t offset; /* stream bytes before the one looked at */
+	uint8_t pkt[TS_MAX_PACKET_SIZE]; /* packet split across two reads */
+	size_t pkt_len;
+	/* lost: bytes not ruled out yet. locked: a packet with a bad sync byte and what follows */
+	uint8_t carry[2 * TS_SYNC_WINDOW];
+	size_t carry_len;
+	uint64_t losses;
+	uint64_t byte_errors;
+	uint64_t skipped;
+	uint64_t lost_at[TS_SYNC_EVENTS];
+	uint64_t found_at[TS_SYNC_EVENTS];
+	uint64_t fed; /* stream bytes handed to ts_feed() */
+	uint64_t read_at; /* stream offset of the last read, where ts_ops->stamps start */
+} tsync;
+
+/* arrival time of the byte at stream offset, of its own datagram where the input has them */
+static uint64_t ts_stamp(uint64_t offset)
+{
+	const struct io_stamp *s;
+	size_t lo = 0, hi, mid;
+	uint64_t at;
+
+	if (ts_ops == NULL)
 		return 0;
+	if (ts_ops->stamps_num == 0 || offset < tsync.read_at)
+		return ts_ops->stamp;
+	at = offset - tsync.read_at;
+	s = ts_ops->stamps;
+	hi = ts_ops->stamps_num;
+	/* the last datagram that starts at or before it */
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (s[mid].at <= at)
+			lo = mid;
+		else
+			hi = mid;
 	}
+	return s[lo].stamp;
+}
 
-	if (head.PID < 0x20 || check_pmt_pid(head.PID)) // take as psi
-		psi_or_pes = 0;
+static void ts_sync_lost(void)
+{
+	etr_error(ETR_TS_SYNC_LOSS, tsync.offset);
+	if (tsync.losses < TS_SYNC_EVENTS)
+		tsync.lost_at[tsync.losses] = tsync.offset;
+	tsync.losses++;
+	tsync.locked = 0;
+}
 
-	sec_len = section_preproc(head.PID, ptr, len, &pbuf, head.payload_unit_start_indicator, head.continuity_counter,
-							  psi_or_pes);
-	if (sec_len == -1)
-		return 0;
-	
-	/*use filter to process a section*/
-	filter_proc(head.PID, pbuf, sec_len);
+static void ts_sync_skip(size_t n)
+{
+	tsync.skipped += n;
+	tsync.offset += n;
+}
 
-	return 0;
+static void ts_sync_found(void)
+{
+	if (tsync.losses && tsync.losses <= TS_SYNC_EVENTS)
+		tsync.found_at[tsync.losses - 1] = tsync.offset;
+	tsync.locked = 1;
+}
+
+/* packets from ptr on up to the first one out of sync */
+static inline __attribute__((always_inline)) size_t ts_run(uint8_t *ptr, size_t len, size_t stride)
+{
+	size_t n = len / stride, i, k = 0, m, ok;
+	uint64_t off;
+	uint8_t act;
+	struct ts_batch b;
+
+	while (k < n) {
+		m = n - k < TS_BATCH ? n - k : TS_BATCH;
+		off = tsync.offset + k * stride;
+		if (unlikely(off >= etr_tick_at))
+			etr_tick(off, ts_ops ? ts_ops->stamp : 0);
+		if (unlikely(off >= bitrate_tick_at))
+			bitrate_tick(off);
+		ok = ts_decode_batch(ptr + k * stride, m, stride, &b);
+		ts_count_batch(&b, ok, ptr + k * stride, stride, off);
+		for (i = 0; i < ok; i++) {
+			act = filter_action[b.pid[i]];
+			/* PES headers are only looked at where a PES packet starts */
+			if (act != FILTER_ACT_COUNT && (act != FILTER_ACT_PTS || b.pusi[i]))
+				ts_payload(ptr + (k + i) * stride, (uint8_t)stride, &b, i, off + i * stride);
+		}
+		k += ok;
+		if (ok < m)
+			break;
+	}
+	return k * stride;
+}
+
+/* in sync packets from ptr on, a loop of its own for each packet size */
+static size_t ts_run_locked(uint8_t *ptr, size_t len, size_t stride)
+{
+	switch (stride) {
+	case TS_PACKET_SIZE:
+		return ts_run(ptr, len, TS_PACKET_SIZE);
+	case TS_DVHS_PACKET_SIZE:
+		return ts_run(ptr, len, TS_DVHS_PACKET_SIZE);
+	default:
+		return ts_run(ptr, len, TS_FEC_PACKET_SIZE);
+	}
+}
+
+/* search on in the bytes carried over, with the start of the new read behind them */
+static void ts_sync_join(uint8_t **ptr, size_t *len, size_t stride)
+{
+	size_t c = tsync.carry_len, take = *len < TS_SYNC_WINDOW ? *len : TS_SYNC_WINDOW, jl, off, k;
+
+	memcpy(tsync.carry + c, *ptr, take);
+	jl = c + take;
+	tsync.carry_len = 0;
+	if (!ts_sync_lock(tsync.carry, jl, stride, &off)) {
+		ts_sync_skip(off);
+		if (off >= c) {
+			*ptr += off - c;
+			*len -= off - c;
+		} else {
+			/* the whole read was joined, still undecided */
+			memmove(tsync.carry, tsync.carry + off, jl - off);
+			tsync.carry_len = jl - off;
+			*ptr += *len;
+			*len = 0;
+		}
+		return;
+	}
+	ts_sync_skip(off);
+	ts_sync_found();
+	/* the lock covers the sync bytes of the packets that start in the carried bytes */
+	for (k = off; k < c && k + stride <= jl; k += stride)
+		ts_proc_at(tsync.carry + k, (uint8_t)stride, tsync.offset + k - off);
+	tsync.offset += k - off;
+	if (k < c) {
+		memcpy(tsync.pkt, tsync.carry + k, jl - k);
+		tsync.pkt_len = jl - k;
+		tsync.offset += jl - k;
+		*ptr += *len;
+		*len = 0;
+		return;
+	}
+	*ptr += k - c;
+	*len -= k - c;
+}
+
+/* a bad sync byte at the end of the last read, the next one shows whether the packet after it is in place */
+static void ts_sync_pending(uint8_t **ptr, size_t *len, size_t stride)
+{
+	size_t c = tsync.carry_len, take;
+
+	if (c <= stride) {
+		take = stride + 1 - c < *len ? stride + 1 - c : *len;
+		memcpy(tsync.carry + c, *ptr, take);
+		*ptr += take;
+		*len -= take;
+		c += take;
+		tsync.carry_len = c;
+		if (c <= stride)
+			return;
+	}
+	tsync.carry_len = 0;
+	if (tsync.carry[stride] == TS_SYNC_BYTE) {
+		tsync.byte_errors++;
+		etr_error(ETR_SYNC_BYTE, tsync.offset);
+		ts_sync_skip(stride);
+		memcpy(tsync.pkt, tsync.carry + stride, c - stride);
+		tsync.pkt_len = c - stride;
+		tsync.offset += c - stride;
+		return;
+	}
+	ts_sync_lost();
+	ts_sync_skip(1);
+	memmove(tsync.carry, tsync.carry + 1, c - 1);
+	tsync.carry_len = c - 1;
+}
+
+/* everything of one read, what is left for the next one is kept in tsync */
+static void ts_feed(uint8_t *ptr, size_t len, size_t stride)
+{
+	size_t n, off;
+
+	if (tsync.locked && tsync.carry_len)
+		ts_sync_pending(&ptr, &len, stride);
+	if (tsync.pkt_len) {
+		n = stride - tsync.pkt_len < len ? stride - tsync.pkt_len : len;
+		memcpy(tsync.pkt + tsync.pkt_len, ptr, n);
+		tsync.pkt_len += n;
+		tsync.offset += n;
+		ptr += n;
+		len -= n;
+		if (tsync.pkt_len < stride)
+			return;
+		ts_proc_at(tsync.pkt, (uint8_t)stride, tsync.offset - stride);
+		tsync.pkt_len = 0;
+	}
+	if (!tsync.locked && tsync.carry_len)
+		ts_sync_join(&ptr, &len, stride);
+
+	while (len > 0) {
+		if (!tsync.locked) {
+			if (!ts_sync_lock(ptr, len, stride, &off)) {
+				ts_sync_skip(off);
+				memcpy(tsync.carry, ptr + off, len - off);
+				tsync.carry_len = len - off;
+				return;
+			}
+			ts_sync_skip(off);
+			ts_sync_found();
+			ptr += off;
+			len -= off;
+		}
+		n = ts_run_locked(ptr, len, stride);
+		tsync.offset += n;
+		ptr += n;
+		len -= n;
+		if (len == 0)
+			break;
+		if (len < stride && ptr[0] == TS_SYNC_BYTE) {
+			memcpy(tsync.pkt, ptr, len);
+			tsync.pkt_len = len;
+			tsync.offset += len;
+			break;
+		}
+		if (len < 2 * stride) {
+			memcpy(tsync.carry, ptr, len);
+			tsync.carry_len = len;
+			break;
+		}
+		/* a packet with a bad sync byte between two good ones is dropped alone */
+		if (ptr[stride] == TS_SYNC_BYTE) {
+			tsync.byte_errors++;
+			etr_error(ETR_SYNC_BYTE, tsync.offset);
+			ts_sync_skip(stride);
+			ptr += stride;
+			len -= stride;
+			continue;
+		}
+		ts_sync_lost();
+		ts_sync_skip(1);
+		ptr++;
+		len--;
+	}
+}
+
+static void dump_ts_sync(void)
+{
+	uint64_t i;
+
+	if (tsync.losses == 0 && tsync.byte_errors == 0)
+		return;
+	printf("\n");
+	printf("TS sync:\n");
+	printf("%12s%14s%16s\n", "Losses", "Byte errors", "Skipped bytes");
+	printf("%12" PRIu64 "%14" PRIu64 "%16" PRIu64 "\n", tsync.losses, tsync.byte_errors, tsync.skipped);
+	if (tsync.losses == 0)
+		return;
+	printf("%16s%16s\n", "Lost at", "Found at");
+	for (i = 0; i < tsync.losses && i < TS_SYNC_EVENTS; i++) {
+		if (i + 1 == tsync.losses && !tsync.locked)
+			printf("%16" PRIu64 "%16s\n", tsync.lost_at[i], "-");
+		else
+			printf("%16" PRIu64 "%16" PRIu64 "\n", tsync.lost_at[i], tsync.found_at[i]);
+	}
+}
+
+/* HH:MM:SS.mmm of an error time, the local time of day for arrival stamps */
+static void ts_clock_str(char *buf, size_t len, uint64_t ns)
+{
+	time_t sec = (time_t)(ns / 1000000000ULL);
+	struct tm tm;
+
+	if (ns == TS_NO_TIME) {
+		snprintf(buf, len, "-");
+		return;
+	}
+	if (cc_time_arrival) {
+		localtime_r(&sec, &tm);
+		snprintf(buf, len, "%02d:%02d:%02d.%03d", tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(ns / 1000000ULL % 1000));
+	} else {
+		snprintf(buf, len, "%02d:%02d:%02d.%03d", (int)(sec / 3600 % 100), (int)(sec / 60 % 60), (int)(sec % 60),
+				 (int)(ns / 1000000ULL % 1000));
+	}
 }
 
 void dump_ts_info(void)
 {
 	struct tsa_config *tsaconf = get_config();
+
+	dump_ts_sync();
 	if (tsaconf->detail == 0)
 		return;
+	dump_etr();
+	/* on stdout dump_tables() has given the same already */
+	if (tsaconf->output != RES_STD) {
+		dump_bitrate();
+		dump_pcr();
+	}
 
 	uint16_t pid = 0;
+	int cc_errors = 0;
 	printf("\n");
 	printf("TS bits statistics:\n");
-	printf("%7s%21s%11s\n", "PID", "In", "Err");
+	printf("%7s%21s%11s%11s%11s%11s\n", "PID", "In", "TEI", "CC err", "Dup", "Lost");
 	for (pid = 0; pid <= NULL_PID; pid++) {
 		if (pid_dev[pid].pkts_in)
-			printf("%04d(0x%04x)  %2c  %10" PRIu64 "%10" PRIu64 "\n", pid, pid, ':', pid_dev[pid].pkts_in,
-				   pid_dev[pid].error_in);
+			printf("%04d(0x%04x)  %2c  %10" PRIu64 "%11" PRIu64 "%11" PRIu64 "%11" PRIu64 "%11" PRIu64 "\n", pid,
+				   pid, ':', pid_dev[pid].pkts_in, pid_dev[pid].error_in, cc_err[pid].errors, cc_err[pid].dups,
+				   cc_err[pid].lost);
+		if (cc_err[pid].errors)
+			cc_errors = 1;
+	}
+	if (!cc_errors)
+		return;
+
+	char first[16], last[16];
+	printf("\n");
+	printf("Continuity errors:\n");
+	printf("%7s%21s%16s%16s%16s\n", "PID", "First at", "Last at", "First time", "Last time");
+	for (pid = 0; pid < NULL_PID; pid++) {
+		if (cc_err[pid].errors == 0)
+			continue;
+		ts_clock_str(first, sizeof(first), cc_err[pid].first_time);
+		ts_clock_str(last, sizeof(last), cc_err[pid].last_time);
+		printf("%04d(0x%04x)  %2c  %10" PRIu64 "%16" PRIu64 "%16s%16s\n", pid, pid, ':', cc_err[pid].first_at,
+			   cc_err[pid].last_at, first, last);
 	}
 }
 
 int init_pid_processor(void)
 {
 	filter_init();
+	etr_init();
+	bitrate_init();
+	pcr_init();
 	init_table_ops();
 	init_descriptor_parsers();
 	return 0;
@@ -294,22 +816,54 @@ void uninit_pid_processor(void)
 	uninit_table_ops();
 }
 
+/* enough for mpegts_probe() to check CHECK_COUNT packets of any size */
+#define PROBE_SIZE (TS_FEC_PACKET_SIZE * CHECK_COUNT * 2)
+
 int ts_process()
 {
 	struct tsa_config *tsaconf = get_config();
 	struct io_ops *ops = lookup_io_ops(tsaconf->type);
-	void *ptr = NULL;
-	size_t len, ts_pktlen = 0, pkt_con_len = 0;
+	uint8_t *ptr = NULL, *rest = NULL;
+	size_t len, rest_len = 0, ts_pktlen = 0, need;
+	uint64_t last_read = 0; /* stream offset the last read starts at */
 	int start_index = 0;
-	int typ;
-	uint8_t pkt_con[TS_FEC_PACKET_SIZE];
+	int typ, ret;
+	uint8_t probe[PROBE_SIZE];
 
-	if (ops->open(tsaconf->name) < 0)
+	if (ops == NULL || ops->open(tsaconf->name) < 0)
 		return -1;
+	ts_ops = ops;
 
-	ops->read(&ptr, &len);
+	if (ops->read((void **)&ptr, &len) < 0) {
+		ops->close();
+		return -1;
+	}
 
-	typ = mpegts_probe((uint8_t *)ptr, len);
+	/*
+	 * datagram inputs hand out less than the probe needs per read, gather
+	 * a few reads first. whatever is left of the last one is processed
+	 * right after the gathered data
+	 */
+	if (len < PROBE_SIZE) {
+		size_t plen = len;
+		memcpy(probe, ptr, len);
+		len = 0;
+		while (plen < PROBE_SIZE && ops->end() > 0 && ops->read((void **)&ptr, &len) == 0) {
+			last_read = plen;
+			need = PROBE_SIZE - plen < len ? PROBE_SIZE - plen : len;
+			memcpy(probe + plen, ptr, need);
+			plen += need;
+			ptr += need;
+			len -= need;
+		}
+		rest = ptr;
+		rest_len = len;
+		ptr = probe;
+		len = plen;
+	}
+
+	/* only the start, the alignment may change further into a large read */
+	typ = mpegts_probe(ptr, len < PROBE_SIZE ? len : PROBE_SIZE);
 	if (typ == 0) {
 		ts_pktlen = TS_PACKET_SIZE;
 	} else if (typ == 1) {
@@ -318,6 +872,7 @@ int ts_process()
 		ts_pktlen = TS_FEC_PACKET_SIZE;
 	} else {
 		printf("TS file invalid format\n");
+		ops->close();
 		return -1;
 	}
 
@@ -328,31 +883,31 @@ int ts_process()
 
 	ptr += start_index;
 	len -= start_index;
-
-	while (ops->end()) {
-		if (pkt_con_len == ts_pktlen) {
-			ts_proc(pkt_con, ts_pktlen);
-			pkt_con_len = 0;
-		}
-		while (len >= ts_pktlen) {
-			ts_proc(ptr, ts_pktlen);
-			len -= ts_pktlen;
-			ptr += ts_pktlen;
-		}
-		if (len) {
-			memcpy(pkt_con, ptr, len);
-			pkt_con_len = len;
-		}
-		if (ops->read(&ptr, &len) < 0)
-			break;
-		if (pkt_con_len) {
-			memcpy(pkt_con + pkt_con_len, ptr, ts_pktlen - pkt_con_len);
-			ptr += ts_pktlen - pkt_con_len;
-			len -= (ts_pktlen - pkt_con_len);
-			pkt_con_len = ts_pktlen;
+	memset(&tsync, 0, sizeof(tsync));
+	tsync.locked = 1;
+	tsync.offset = (uint64_t)start_index;
+	tsync.fed = (uint64_t)start_index;
+	/* the stamps of the last read gathered into the probe go on into the rest of it */
+	tsync.read_at = last_read;
+
+	for (;;) {
+		ts_feed(ptr, len, ts_pktlen);
+		tsync.fed += len;
+		if (rest_len) {
+			ptr = rest;
+			len = rest_len;
+			rest_len = 0;
+		} else {
+			tsync.read_at = tsync.fed;
+			if (ops->end() <= 0)
+				break;
+			if (ops->read((void **)&ptr, &len) < 0)
+				break;
 		}
 	}
+	/* a failed input ends the loop like its end would */
+	ret = ops->end() < 0 ? -1 : 0;
 	ops->close();
 
-	return 0;
+	return ret;
 }
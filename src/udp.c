@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,19 +10,50 @@
 #endif
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <net/if.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "comm.h"
 #include "io.h"
+#include "mdi.h"
+#include "ts.h"
+#include "udp.h"
+
+/*
+ * datagrams are received in batches with recvmmsg() straight into one
+ * contiguous area, slot i at i * stride. as long as every datagram of a batch
+ * fills its slot the whole batch is handed out as one run of packets, odd
+ * sized datagrams are gathered into the staging area instead.
+ * kernel receive timestamps of all datagrams feed the MDI figures, the
+ * continuity counter errors found by the analyzer its loss figures. the
+ * socket reports its drop counter, the receive buffer grows with the input
+ * rate and on drops, so loss in front of the analyzer can be told apart from
+ * loss on the network.
+ */
+#define UDP_BATCH (64)
+#define UDP_DEFAULT_STRIDE (7 * TS_PACKET_SIZE)
+#define UDP_RCVBUF_MIN (4 * 1024 * 1024)
+#define UDP_RCVBUF_MAX (256 * 1024 * 1024)
+#define UDP_RCVBUF_MS (500) /* input the socket buffer should hold */
 
 static struct io_ops udp_ops;
 
-struct url {
-	char proto[32];
-	uint32_t addr;
-	uint32_t port;
-};
+static struct {
+	uint8_t *ring; /* UDP_BATCH slots of stride bytes */
+	uint8_t *stage; /* gather area for irregular batches */
+	uint8_t spill[UDP_BATCH][UDP_MAX_DGRAM];
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH][2];
+	uint8_t cmsg[UDP_BATCH][UDP_CMSG_SPACE];
+	struct io_stamp stamps[UDP_BATCH];
+	struct mdi mdi;
+	struct udp_rx rx;
+	size_t stride;
+} udp;
 
 void parse_url(const char *url, const char *protocl, uint32_t *addr, uint32_t *port)
 {
@@ -47,64 +80,344 @@ void parse_url(const char *url, const char *protocl, uint32_t *addr, uint32_t *p
 	}
 }
 
-static struct url *parse_url_path(const char *urlpath)
+/*
+ * options follow the address, udp://[source@]addr:port?ifaddr=a.b.c.d&busy_poll=50
+ * ifname=eth0 selects the interface by name instead of by address, fec=1
+ * adds the FEC streams of rtp input
+ */
+static void parse_url_options(const char *url, struct url *surl)
+{
+	const char *opt = strchr(url, '?');
+	char item[64], *val;
+	surl->busy_poll = 0;
+	surl->ifaddr = 0;
+	surl->ifindex = 0;
+	surl->fec = 0;
+	while (opt != NULL) {
+		opt++;
+		snprintf(item, sizeof(item), "%.*s", (int)strcspn(opt, "&"), opt);
+		val = strchr(item, '=');
+		if (val != NULL) {
+			*val++ = '\0';
+			if (strcmp(item, "busy_poll") == 0)
+				surl->busy_poll = atoi(val);
+			else if (strcmp(item, "ifaddr") == 0)
+				surl->ifaddr = inet_addr(val);
+			else if (strcmp(item, "ifname") == 0)
+				surl->ifindex = if_nametoindex(val);
+			else if (strcmp(item, "fec") == 0)
+				surl->fec = atoi(val);
+		}
+		opt = strchr(opt, '&');
+	}
+}
+
+struct url *parse_url_path(const char *urlpath, const char *proto)
 {
 	static struct url surl;
-	if (strncmp(urlpath, "udp", 3) != 0) {
+	char path[256];
+	char *opt, *at;
+	size_t skip = strlen(proto) + 3;
+	if (strncmp(urlpath, proto, strlen(proto)) != 0) {
 		return NULL;
 	}
-	parse_url(urlpath, "udp", &surl.addr, &surl.port);
+	snprintf(path, sizeof(path), "%s", urlpath);
+	opt = strchr(path, '?');
+	if (opt != NULL)
+		*opt = '\0';
+	surl.source = 0;
+	at = strchr(path, '@');
+	if (at != NULL && at > path + skip) {
+		/* udp://source@group:port, cut the source out of the path */
+		*at = '\0';
+		surl.source = inet_addr(path + skip);
+		memmove(path + skip, at + 1, strlen(at + 1) + 1);
+	}
+	snprintf(surl.proto, sizeof(surl.proto), "%s", proto);
+	parse_url(path, proto, &surl.addr, &surl.port);
+	parse_url_options(urlpath, &surl);
 	return &surl;
 }
 
-int udp_open(const char *urlpath)
+static int udp_join(int fd, struct url *surl)
 {
-	struct url *surl = parse_url_path(urlpath);
-	int ip_shift = 24, i;
-	uint8_t ip[4];
-	char ipstr[16];
-	for (i = 0; i < 4; i++) {
-		ip[i] = (surl->addr >> ip_shift) & 0xFF;
-		ip_shift -= 8;
+	if (surl->source != 0) {
+		struct ip_mreq_source mreqs;
+		memset(&mreqs, 0, sizeof(mreqs));
+		mreqs.imr_multiaddr.s_addr = surl->addr;
+		mreqs.imr_sourceaddr.s_addr = surl->source;
+		mreqs.imr_interface.s_addr = surl->ifaddr;
+		return setsockopt(fd, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, &mreqs, sizeof(mreqs));
 	}
-	snprintf(ipstr, 16, "%u.%u.%u.%u", ip[3], ip[2], ip[1], ip[0]);
+#ifdef __linux__
+	if (surl->ifindex != 0) {
+		struct ip_mreqn mreqn;
+		memset(&mreqn, 0, sizeof(mreqn));
+		mreqn.imr_multiaddr.s_addr = surl->addr;
+		mreqn.imr_ifindex = (int)surl->ifindex;
+		return setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreqn, sizeof(mreqn));
+	}
+#endif
+	struct ip_mreq mreq;
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.imr_multiaddr.s_addr = surl->addr;
+	mreq.imr_interface.s_addr = surl->ifaddr;
+	return setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+}
 
-	int ret;
+/*
+ * multicast sockets bind the group address so each one only sees its own
+ * group, SO_REUSEPORT lets the per group workers share the port
+ */
+int udp_socket(struct url *surl)
+{
 	struct sockaddr_in addr;
+	int fd, multicast = IN_MULTICAST(ntohl(surl->addr));
+
+	memset(&addr, 0, sizeof(addr));
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(surl->port);
-	addr.sin_addr.s_addr = htonl(INADDR_ANY); // inet_addr("127.0.0.1");
-	unsigned int len = sizeof(struct sockaddr);
+	addr.sin_addr.s_addr = multicast ? surl->addr : htonl(INADDR_ANY);
 
-	udp_ops.fd = socket(AF_INET, SOCK_DGRAM, 0);
-	if (udp_ops.fd < 0) {
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
 		return -1;
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+	}
+#ifdef SO_NOSIGPIPE
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){ 1 }, sizeof(int));
+#endif
+#ifdef SO_BUSY_POLL
+	if (surl->busy_poll > 0)
+		setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &surl->busy_poll, sizeof(int));
+#endif
+#ifdef SO_TIMESTAMPNS
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &(int){ 1 }, sizeof(int));
+#endif
+#ifdef SO_RXQ_OVFL
+	setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &(int){ 1 }, sizeof(int));
+#endif
+	if (multicast) {
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int));
+#ifdef SO_REUSEPORT
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int){ 1 }, sizeof(int));
+#endif
+#ifdef IP_MULTICAST_ALL
+		/* do not get groups joined by other sockets on the same port */
+		setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &(int){ 0 }, sizeof(int));
+#endif
 	}
-	udp_ops.block_size = 1024 * 2;
-	if (udp_ops.fd != -1) {
-		if (fcntl(udp_ops.fd, F_SETFD, FD_CLOEXEC) == -1) {
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (multicast && udp_join(fd, surl) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+uint64_t udp_msg_info(struct msghdr *mh, uint32_t *drops)
+{
+	struct cmsghdr *c;
+	struct timespec ts;
+	uint64_t stamp = 0;
+	for (c = CMSG_FIRSTHDR(mh); c != NULL; c = CMSG_NXTHDR(mh, c)) {
+		if (c->cmsg_level != SOL_SOCKET)
+			continue;
+#ifdef SCM_TIMESTAMPNS
+		if (c->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+			stamp = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
 		}
+#endif
+#ifdef SO_RXQ_OVFL
+		if (c->cmsg_type == SO_RXQ_OVFL)
+			memcpy(drops, CMSG_DATA(c), sizeof(*drops));
+#endif
 	}
-#ifdef SO_NOSIGPIPE
-	if (udp_ops.fd != -1)
-		setsockopt(udp_ops.fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){ 1 }, sizeof(int));
+	return stamp;
+}
+
+static int udp_rx_set(struct udp_rx *rx, int size)
+{
+	socklen_t len = sizeof(rx->rcvbuf);
+#ifdef SO_RCVBUFFORCE
+	if (setsockopt(rx->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0)
+		rx->forced = 1;
+	else
 #endif
-	ret = bind(udp_ops.fd, (struct sockaddr *)&addr, len);
-	if (ret < 0) {
+		setsockopt(rx->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	return getsockopt(rx->fd, SOL_SOCKET, SO_RCVBUF, &rx->rcvbuf, &len);
+}
+
+void udp_rx_init(struct udp_rx *rx, int fd)
+{
+	memset(rx, 0, sizeof(*rx));
+	rx->fd = fd;
+	udp_rx_set(rx, UDP_RCVBUF_MIN);
+}
+
+void udp_rx_update(struct udp_rx *rx, uint64_t now, uint64_t bytes, uint32_t drops)
+{
+	uint64_t want;
+
+	rx->drops = drops;
+	rx->bytes += bytes;
+	if (unlikely(rx->check == 0 || now < rx->check)) {
+		rx->check = now;
+		return;
 	}
-	getsockname(udp_ops.fd, (struct sockaddr *)&addr, &(len));
-	// printf("%s \n",inet_ntoa(addr.sin_addr));
+	if (likely(now - rx->check < 1000000000))
+		return;
+	want = rx->bytes * UDP_RCVBUF_MS / ((now - rx->check) / 1000000);
+	/* drops since the last check, the buffer did not cover our stalls */
+	if (rx->drops != rx->seen) {
+		if (want < (uint64_t)rx->rcvbuf / 2)
+			want = (uint64_t)rx->rcvbuf / 2;
+		want *= 2;
+	}
+	if (want > UDP_RCVBUF_MAX)
+		want = UDP_RCVBUF_MAX;
+	/* the kernel reports twice the size asked for */
+	if (want * 2 > (uint64_t)rx->rcvbuf && udp_rx_set(rx, (int)want) == 0)
+		rx->resized++;
+	rx->seen = rx->drops;
+	rx->check = now;
+	rx->bytes = 0;
+}
+
+void udp_rx_dump(struct udp_rx *rx)
+{
+	printf("\n");
+	printf("Socket receive buffer:\n");
+	printf("%14s%12s%12s%14s\n", "Rcvbuf(KB)", "Forced", "Resized", "Kernel drops");
+	printf("%14d%12s%12u%14u\n", rx->rcvbuf / 1024, rx->forced ? "yes" : "no", rx->resized, rx->drops);
+}
+
+static void udp_setup_batch(size_t stride)
+{
+	int i;
+	udp.stride = stride;
+	for (i = 0; i < UDP_BATCH; i++) {
+		udp.iov[i][0].iov_base = udp.ring + i * stride;
+		udp.iov[i][0].iov_len = stride;
+		udp.iov[i][1].iov_base = udp.spill[i];
+		udp.iov[i][1].iov_len = UDP_MAX_DGRAM - stride;
+		memset(&udp.msgs[i], 0, sizeof(udp.msgs[i]));
+		udp.msgs[i].msg_hdr.msg_iov = udp.iov[i];
+		udp.msgs[i].msg_hdr.msg_iovlen = 2;
+		udp.msgs[i].msg_hdr.msg_control = udp.cmsg[i];
+		udp.msgs[i].msg_hdr.msg_controllen = UDP_CMSG_SPACE;
+	}
+}
+
+int udp_close(void);
+
+int udp_open(const char *urlpath)
+{
+	struct url *surl = parse_url_path(urlpath, "udp");
+	if (surl == NULL)
+		return -1;
+
+	udp_ops.fd = udp_socket(surl);
+	if (udp_ops.fd < 0) {
+		return -1;
+	}
+	udp_ops.block_size = UDP_BATCH * UDP_MAX_DGRAM;
+
+	udp.ring = malloc(UDP_BATCH * UDP_MAX_DGRAM);
+	udp.stage = malloc(UDP_BATCH * UDP_MAX_DGRAM);
+	if (udp.ring == NULL || udp.stage == NULL) {
+		udp_close();
+		return -1;
+	}
+	udp_setup_batch(UDP_DEFAULT_STRIDE);
+	mdi_init(&udp.mdi, get_config()->mdi_interval);
+	udp_rx_init(&udp.rx, udp_ops.fd);
 	return 0;
 }
 
+/* gather a batch holding datagrams that do not match the slot stride */
+static size_t udp_gather(int n)
+{
+	size_t off = 0, l, first = udp.msgs[0].msg_len;
+	int i, same = 1;
+	for (i = 0; i < n; i++) {
+		l = udp.msgs[i].msg_len;
+		if (l != first)
+			same = 0;
+		if (l <= udp.stride) {
+			memcpy(udp.stage + off, udp.iov[i][0].iov_base, l);
+		} else {
+			memcpy(udp.stage + off, udp.iov[i][0].iov_base, udp.stride);
+			memcpy(udp.stage + off + udp.stride, udp.spill[i], l - udp.stride);
+		}
+		off += l;
+	}
+	/* sender uses another constant size, follow it for the next batches */
+	if (same && first > 0 && first < UDP_MAX_DGRAM)
+		udp_setup_batch(first);
+	return off;
+}
+
+/* arrival times of a batch, read before the batch may be regathered */
+static void udp_account(int n)
+{
+	struct timespec now;
+	uint64_t t = 0, fallback = 0, bytes = 0;
+	uint32_t drops = udp.rx.drops;
+	int i;
+	for (i = 0; i < n; i++) {
+		t = udp_msg_info(&udp.msgs[i].msg_hdr, &drops);
+		if (unlikely(t == 0)) {
+			if (fallback == 0) {
+				clock_gettime(CLOCK_REALTIME, &now);
+				fallback = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+			}
+			t = fallback;
+		}
+		mdi_arrival(&udp.mdi, t, udp.msgs[i].msg_len);
+		udp.stamps[i].at = bytes;
+		udp.stamps[i].stamp = t;
+		bytes += udp.msgs[i].msg_len;
+		udp.msgs[i].msg_hdr.msg_controllen = UDP_CMSG_SPACE;
+	}
+	udp_rx_update(&udp.rx, t, bytes, drops);
+	udp_ops.stamp = t;
+	udp_ops.stamps = udp.stamps;
+	udp_ops.stamps_num = (size_t)n;
+}
+
 int udp_read(void **ptr, size_t *len)
 {
-	static unsigned char buf[2048];
-	int size = 2048;
-	int ret;
-	ret = recv(udp_ops.fd, buf, size, 0);
-	*ptr = buf;
-	*len = ret;
+	int n, i;
+	size_t total = 0;
+
+	do {
+		n = recvmmsg(udp_ops.fd, udp.msgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		*ptr = NULL;
+		*len = 0;
+		return -1;
+	}
+	udp_account(n);
+
+	for (i = 0; i < n; i++) {
+		if (unlikely(udp.msgs[i].msg_len != udp.stride))
+			break;
+		total += udp.stride;
+	}
+	if (likely(i == n)) {
+		*ptr = udp.ring;
+		*len = total;
+	} else {
+		*ptr = udp.stage;
+		*len = udp_gather(n);
+	}
+	udp_ops.ptr = *ptr;
 	return 0;
 }
 
@@ -112,21 +425,40 @@ int udp_close(void)
 {
 	if (udp_ops.fd >= 0)
 		close(udp_ops.fd);
+	udp_ops.fd = -1;
+	free(udp.ring);
+	free(udp.stage);
+	udp.ring = NULL;
+	udp.stage = NULL;
 	return 0;
 }
 
-static int udp_end(void)
+static int64_t udp_end(void)
 {
 	/*how to define the end of a stream*/
 	return 1;
 }
 
+/* without sequence numbers the continuity counters tell the media loss (RFC 4445 MLR) */
+static void udp_loss(uint64_t pkts)
+{
+	mdi_loss(&udp.mdi, pkts);
+}
+
+static void udp_dump(void)
+{
+	mdi_dump("input", &udp.mdi);
+	udp_rx_dump(&udp.rx);
+}
+
 static struct io_ops udp_ops = {
 	.type = IO_UDP,
 	.open = udp_open,
 	.read = udp_read,
 	.close = udp_close,
 	.end = udp_end,
+	.dump = udp_dump,
+	.loss = udp_loss,
 };
 
 REGISTER_IO_OPS(udp, &udp_ops);
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "io.h"
+#include "ts.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+
+/*
+ * file input through io_uring: URING_DEPTH reads of block_size are kept in
+ * flight into a pool of registered buffers, completed buffers are handed to
+ * the caller in file order and requeued on the next read(). -m gives the
+ * size of the pool rather than of one read.
+ */
+
+#define URING_DEPTH (16)
+#define URING_DEFAULT_BLOCK (4 * 1024 * 1024)
+#define URING_HUGE_PAGE (2 * 1024 * 1024)
+
+static struct io_ops uring_ops;
+
+struct uring_slot {
+	uint8_t *buf;
+	uint64_t off; /* file offset of buf[0] */
+	size_t want;
+	size_t got;
+	int busy;
+};
+
+static struct {
+	int ring_fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_len, cq_ring_len, sqes_len;
+	uint8_t *pool;
+	size_t pool_len;
+	int fixed; /* pool registered with the ring */
+	unsigned pending; /* sqes queued but not yet entered */
+	unsigned head; /* next slot to hand out */
+	int cur; /* slot owned by the caller, -1 if none */
+	uint64_t submit_off; /* next file offset to queue */
+	struct uring_slot slot[URING_DEPTH];
+} ur;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int uring_setup(void)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ur.ring_fd = sys_io_uring_setup(URING_DEPTH, &p);
+	if (ur.ring_fd < 0)
+		return -1;
+
+	ur.sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur.cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur.cq_ring_len > ur.sq_ring_len)
+			ur.sq_ring_len = ur.cq_ring_len;
+		ur.cq_ring_len = ur.sq_ring_len;
+	}
+	ur.sq_ring = mmap(NULL, ur.sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur.ring_fd,
+					  IORING_OFF_SQ_RING);
+	if (ur.sq_ring == MAP_FAILED)
+		return -1;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur.cq_ring = ur.sq_ring;
+	} else {
+		ur.cq_ring = mmap(NULL, ur.cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur.ring_fd,
+						  IORING_OFF_CQ_RING);
+		if (ur.cq_ring == MAP_FAILED)
+			return -1;
+	}
+	ur.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur.sqes = mmap(NULL, ur.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur.ring_fd,
+				   IORING_OFF_SQES);
+	if (ur.sqes == MAP_FAILED)
+		return -1;
+
+	sq = ur.sq_ring;
+	cq = ur.cq_ring;
+	ur.sq_head = (unsigned *)(sq + p.sq_off.head);
+	ur.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ur.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ur.sq_array = (unsigned *)(sq + p.sq_off.array);
+	ur.cq_head = (unsigned *)(cq + p.cq_off.head);
+	ur.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ur.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ur.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+/* hugetlb pages when reserved, transparent huge pages otherwise */
+static int uring_alloc_pool(size_t block)
+{
+	struct iovec iov[URING_DEPTH];
+	int i;
+
+	ur.pool_len = (block * URING_DEPTH + URING_HUGE_PAGE - 1) / URING_HUGE_PAGE * URING_HUGE_PAGE;
+	ur.pool = mmap(NULL, ur.pool_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ur.pool == MAP_FAILED) {
+		ur.pool = mmap(NULL, ur.pool_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ur.pool == MAP_FAILED) {
+			ur.pool = NULL;
+			return -1;
+		}
+		madvise(ur.pool, ur.pool_len, MADV_HUGEPAGE);
+	}
+
+	for (i = 0; i < URING_DEPTH; i++) {
+		ur.slot[i].buf = ur.pool + (size_t)i * block;
+		iov[i].iov_base = ur.slot[i].buf;
+		iov[i].iov_len = block;
+	}
+	/* pinning may fail on RLIMIT_MEMLOCK, plain reads work as well */
+	ur.fixed = sys_io_uring_register(ur.ring_fd, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) == 0;
+	return 0;
+}
+
+static void uring_queue(int idx)
+{
+	struct uring_slot *s = &ur.slot[idx];
+	unsigned tail = *ur.sq_tail;
+	unsigned index = tail & *ur.sq_mask;
+	struct io_uring_sqe *sqe = &ur.sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = ur.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = uring_ops.fd;
+	sqe->off = s->off + s->got;
+	sqe->addr = (uint64_t)(uintptr_t)(s->buf + s->got);
+	sqe->len = (uint32_t)(s->want - s->got);
+	sqe->buf_index = (uint16_t)idx;
+	sqe->user_data = (uint64_t)idx;
+	ur.sq_array[index] = index;
+	__atomic_store_n(ur.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	s->busy = 1;
+	ur.pending++;
+}
+
+/* give the slot the next block of the file, if any is left */
+static void uring_refill(int idx)
+{
+	struct uring_slot *s = &ur.slot[idx];
+	uint64_t left = uring_ops.total_size - ur.submit_off;
+
+	s->got = 0;
+	s->busy = 0;
+	if (left == 0) {
+		s->want = 0;
+		return;
+	}
+	s->off = ur.submit_off;
+	s->want = left < uring_ops.block_size ? (size_t)left : uring_ops.block_size;
+	ur.submit_off += s->want;
+	uring_queue(idx);
+}
+
+static int uring_reap(void)
+{
+	unsigned head = *ur.cq_head;
+	int reaped = 0;
+
+	while (head != __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &ur.cqes[head & *ur.cq_mask];
+		struct uring_slot *s = &ur.slot[cqe->user_data];
+		s->busy = 0;
+		if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+			uring_queue((int)cqe->user_data);
+		} else if (cqe->res < 0) {
+			head++;
+			__atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+			return -1;
+		} else if (cqe->res == 0) {
+			/* file shrank under us, deliver what we have */
+			s->want = s->got;
+		} else {
+			s->got += (size_t)cqe->res;
+			if (s->got < s->want)
+				uring_queue((int)cqe->user_data);
+		}
+		head++;
+		reaped++;
+	}
+	__atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+	return reaped;
+}
+
+static int uring_wait(struct uring_slot *s)
+{
+	while (s->busy || s->got < s->want) {
+		unsigned submit = ur.pending;
+		ur.pending = 0;
+		if (sys_io_uring_enter(ur.ring_fd, submit, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+			return -1;
+		if (uring_reap() < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void uring_release(void)
+{
+	/* tear the ring down first so nothing is left in flight into the pool */
+	if (ur.ring_fd >= 0)
+		close(ur.ring_fd);
+	if (ur.pool != NULL)
+		munmap(ur.pool, ur.pool_len);
+	if (ur.sqes != NULL && ur.sqes != MAP_FAILED)
+		munmap(ur.sqes, ur.sqes_len);
+	if (ur.cq_ring != NULL && ur.cq_ring != MAP_FAILED && ur.cq_ring != ur.sq_ring)
+		munmap(ur.cq_ring, ur.cq_ring_len);
+	if (ur.sq_ring != NULL && ur.sq_ring != MAP_FAILED)
+		munmap(ur.sq_ring, ur.sq_ring_len);
+	memset(&ur, 0, sizeof(ur));
+	ur.ring_fd = -1;
+}
+
+static int uringio_close(void);
+
+static int uringio_open(const char *filename)
+{
+	struct tsa_config *tsaconf = get_config();
+	struct stat st;
+	int i;
+
+	if (filename == NULL)
+		return -1;
+	memset(&ur, 0, sizeof(ur));
+	ur.ring_fd = -1;
+	ur.cur = -1;
+	uring_ops.fd = open(filename, O_RDONLY);
+	if (uring_ops.fd < 0)
+		return -1;
+	if (fstat(uring_ops.fd, &st) < 0)
+		goto fail;
+	uring_ops.total_size = (uint64_t)st.st_size;
+	uring_ops.offset = 0;
+	uring_ops.block_size = URING_DEFAULT_BLOCK;
+	/* -m sizes the whole pool here, every slot of it is pinned */
+	if (tsaconf->mem)
+		uring_ops.block_size = (size_t)tsaconf->mem * 1024 * 1024 / URING_DEPTH;
+	posix_fadvise(uring_ops.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (uring_setup() < 0 || uring_alloc_pool(uring_ops.block_size) < 0)
+		goto fail;
+
+	for (i = 0; i < URING_DEPTH; i++)
+		uring_refill(i);
+	return 0;
+
+fail:
+	uringio_close();
+	return -1;
+}
+
+static int uringio_read(void **ptr, size_t *len)
+{
+	struct uring_slot *s;
+
+	/* caller is done with the previous buffer, reuse it for readahead */
+	if (ur.cur >= 0) {
+		uring_refill(ur.cur);
+		ur.cur = -1;
+	}
+
+	s = &ur.slot[ur.head];
+	if (unlikely(s->want == 0 || uring_wait(s) < 0)) {
+		*ptr = NULL;
+		*len = 0;
+		return -1;
+	}
+	ur.cur = (int)ur.head;
+	ur.head = (ur.head + 1) % URING_DEPTH;
+	uring_ops.ptr = s->buf;
+	uring_ops.offset += s->got;
+	*ptr = s->buf;
+	*len = s->got;
+	return 0;
+}
+
+static int uringio_close(void)
+{
+	uring_release();
+	if (uring_ops.fd >= 0)
+		close(uring_ops.fd);
+	uring_ops.fd = -1;
+	uring_ops.ptr = NULL;
+	uring_ops.offset = 0;
+	return 0;
+}
+
+static int64_t uringio_end(void)
+{
+	return (int64_t)(uring_ops.total_size - uring_ops.offset);
+}
+
+static struct io_ops uring_ops = {
+	.type = IO_URING,
+	.fd = -1,
+	.open = uringio_open,
+	.read = uringio_read,
+	.close = uringio_close,
+	.end = uringio_end,
+};
+
+REGISTER_IO_OPS(uring, &uring_ops);
+
+#endif
@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "frame.h"
+#include "io.h"
+#include "rtp.h"
+#include "ts.h"
+#include "udp.h"
+
+#if defined(__linux__) && defined(__NR_bpf)
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+/*
+ * AF_XDP input: a small XDP program redirects the watched IPv4 UDP flow of
+ * one rx queue into an XSK socket, everything else goes on to the stack.
+ * datagrams land in UMEM frames and payloads are handed out from there, the
+ * frame goes back to the fill ring on the next read.
+ *
+ * the program is built and attached with raw bpf() calls, native (driver)
+ * mode is tried first, then generic mode, which also works on veth.
+ * xdp://addr:port?ifname=eth0[&queue=0][&mode=native|generic]
+ */
+
+#define XDP_NUM_FRAMES (4096)
+#define XDP_FRAME_SIZE (2048)
+#define XDP_RX_SIZE (2048)
+#define XDP_CQ_SIZE (64)
+#define XDP_NO_FRAME (~(uint64_t)0)
+
+#ifndef SOL_XDP
+#define SOL_XDP (283)
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP (44)
+#endif
+
+static struct io_ops xdp_ops;
+
+struct xdp_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *desc;
+	uint32_t mask;
+	uint32_t cached; /* local producer (fill) or consumer (rx) */
+	void *map;
+	size_t map_len;
+};
+
+static struct {
+	uint8_t *umem;
+	struct xdp_ring fill;
+	struct xdp_ring rx;
+	uint64_t cur; /* frame owned by the caller */
+	int map_fd;
+	int prog_fd;
+	int link_fd;
+	int join_fd; /* keeps the multicast membership */
+	unsigned int ifindex;
+	unsigned int queue;
+	uint32_t xdp_flags; /* mode the program got attached in */
+	uint32_t bind_flags;
+	uint32_t daddr;
+	uint16_t dport;
+	uint64_t frames;
+	uint64_t invalid;
+} xsk;
+
+static long xdp_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#define XDP_INSN(c, d, s, o, i)                                                                                        \
+	((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+#define XDP_LDX(size, d, s, o) XDP_INSN(BPF_LDX | BPF_MEM | (size), d, s, o, 0)
+#define XDP_JNE32(d, imm, pc) XDP_INSN(BPF_JMP32 | BPF_JNE | BPF_K, d, 0, XDP_PROG_PASS - (pc)-1, imm)
+#define XDP_NOP XDP_INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0)
+#define XDP_PROG_PASS (25)
+
+/* redirect untagged IPv4 UDP to daddr:dport into the xskmap, pass the rest */
+static int xdp_load_prog(void)
+{
+	struct bpf_insn prog[] = {
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+		XDP_LDX(BPF_W, 2, 6, offsetof(struct xdp_md, data)),
+		XDP_LDX(BPF_W, 3, 6, offsetof(struct xdp_md, data_end)),
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 42),
+		XDP_INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, XDP_PROG_PASS - 6, 0),
+		XDP_LDX(BPF_H, 4, 2, 12),
+		XDP_JNE32(4, htons(ETH_P_IP), 7),
+		XDP_LDX(BPF_B, 4, 2, 14),
+		XDP_JNE32(4, 0x45, 9),
+		XDP_LDX(BPF_B, 4, 2, 23),
+		XDP_JNE32(4, IPPROTO_UDP, 11),
+		XDP_LDX(BPF_H, 4, 2, 20),
+		XDP_INSN(BPF_ALU | BPF_AND | BPF_K, 4, 0, 0, htons(0x3FFF)),
+		XDP_JNE32(4, 0, 14),
+		XDP_LDX(BPF_H, 4, 2, 36),
+		xsk.dport ? XDP_JNE32(4, htons(xsk.dport), 16) : XDP_NOP,
+		XDP_LDX(BPF_W, 4, 2, 30),
+		xsk.daddr ? XDP_JNE32(4, (int32_t)xsk.daddr, 18) : XDP_NOP,
+		XDP_LDX(BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index)),
+		XDP_INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, xsk.map_fd),
+		XDP_INSN(0, 0, 0, 0, 0),
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		XDP_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = xsk.queue + 1;
+	xsk.map_fd = (int)xdp_bpf(BPF_MAP_CREATE, &attr);
+	if (xsk.map_fd < 0)
+		return -1;
+	prog[20].imm = xsk.map_fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t)(uintptr_t)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (uint64_t)(uintptr_t) "GPL";
+	xsk.prog_fd = (int)xdp_bpf(BPF_PROG_LOAD, &attr);
+	return xsk.prog_fd < 0 ? -1 : 0;
+}
+
+static int xdp_attach(uint32_t mode)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = (uint32_t)xsk.prog_fd;
+	attr.link_create.target_ifindex = xsk.ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = mode;
+	xsk.link_fd = (int)xdp_bpf(BPF_LINK_CREATE, &attr);
+	if (xsk.link_fd < 0)
+		return -1;
+	xsk.xdp_flags = mode;
+	return 0;
+}
+
+static int xdp_map_ring(struct xdp_ring *r, struct xdp_ring_offset *off, uint32_t size, size_t desc_size,
+						off_t pgoff)
+{
+	r->map_len = off->desc + size * desc_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xdp_ops.fd, pgoff);
+	if (r->map == MAP_FAILED) {
+		r->map = NULL;
+		return -1;
+	}
+	r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+	r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+	r->flags = (uint32_t *)((uint8_t *)r->map + off->flags);
+	r->desc = (uint8_t *)r->map + off->desc;
+	r->mask = size - 1;
+	return 0;
+}
+
+static int xdp_setup_umem(void)
+{
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	uint64_t *addr;
+	uint32_t i;
+
+	xsk.umem = mmap(NULL, (size_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (xsk.umem == MAP_FAILED) {
+		xsk.umem = NULL;
+		return -1;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uint64_t)(uintptr_t)xsk.umem;
+	reg.len = (uint64_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	if (setsockopt(xdp_ops.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+		setsockopt(xdp_ops.fd, SOL_XDP, XDP_UMEM_FILL_RING, &(int){ XDP_NUM_FRAMES }, sizeof(int)) < 0 ||
+		setsockopt(xdp_ops.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &(int){ XDP_CQ_SIZE }, sizeof(int)) < 0 ||
+		setsockopt(xdp_ops.fd, SOL_XDP, XDP_RX_RING, &(int){ XDP_RX_SIZE }, sizeof(int)) < 0)
+		return -1;
+	if (getsockopt(xdp_ops.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+		return -1;
+	if (xdp_map_ring(&xsk.fill, &off.fr, XDP_NUM_FRAMES, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+		xdp_map_ring(&xsk.rx, &off.rx, XDP_RX_SIZE, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0)
+		return -1;
+
+	/* all frames start out with the kernel */
+	addr = xsk.fill.desc;
+	for (i = 0; i < XDP_NUM_FRAMES; i++)
+		addr[i] = (uint64_t)i * XDP_FRAME_SIZE;
+	xsk.fill.cached = XDP_NUM_FRAMES;
+	__atomic_store_n(xsk.fill.producer, xsk.fill.cached, __ATOMIC_RELEASE);
+	xsk.rx.cached = *xsk.rx.consumer;
+	return 0;
+}
+
+static int xdp_bind(void)
+{
+	struct sockaddr_xdp sxdp;
+	uint32_t flags[3] = { XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP, XDP_COPY | XDP_USE_NEED_WAKEUP, XDP_COPY };
+	int i = xsk.xdp_flags == XDP_FLAGS_DRV_MODE ? 0 : 1;
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = xsk.ifindex;
+	sxdp.sxdp_queue_id = xsk.queue;
+	for (; i < 3; i++) {
+		sxdp.sxdp_flags = (uint16_t)flags[i];
+		if (bind(xdp_ops.fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0) {
+			xsk.bind_flags = flags[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int xdp_close(void);
+
+static int xdp_open(const char *urlpath)
+{
+	struct url *surl = parse_url_path(urlpath, "xdp");
+	const char *opt;
+	union bpf_attr attr;
+	uint32_t key;
+	int mode = 0; /* 0 try native then generic, 1 native, 2 generic */
+
+	if (surl == NULL || surl->ifindex == 0)
+		return -1;
+	memset(&xsk, 0, sizeof(xsk));
+	xsk.map_fd = xsk.prog_fd = xsk.link_fd = xsk.join_fd = -1;
+	xsk.cur = XDP_NO_FRAME;
+	xsk.ifindex = surl->ifindex;
+	xsk.daddr = surl->addr == INADDR_NONE ? 0 : surl->addr;
+	xsk.dport = (uint16_t)surl->port;
+	opt = strstr(urlpath, "queue=");
+	if (opt != NULL)
+		xsk.queue = (unsigned int)atoi(opt + 6);
+	opt = strstr(urlpath, "mode=");
+	if (opt != NULL)
+		mode = strncmp(opt + 5, "native", 6) == 0 ? 1 : (strncmp(opt + 5, "generic", 7) == 0 ? 2 : 0);
+
+	xdp_ops.fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xdp_ops.fd < 0)
+		return -1;
+	if (xdp_setup_umem() < 0 || xdp_load_prog() < 0)
+		goto fail;
+	if ((mode == 2 || xdp_attach(XDP_FLAGS_DRV_MODE) < 0) && (mode == 1 || xdp_attach(XDP_FLAGS_SKB_MODE) < 0))
+		goto fail;
+	if (xdp_bind() < 0)
+		goto fail;
+	key = xsk.queue;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = (uint32_t)xsk.map_fd;
+	attr.key = (uint64_t)(uintptr_t)&key;
+	attr.value = (uint64_t)(uintptr_t)&xdp_ops.fd;
+	if (xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+		goto fail;
+
+	/* the stack never sees the datagrams, a plain socket keeps the group joined */
+	if (IN_MULTICAST(ntohl(xsk.daddr))) {
+		xsk.join_fd = udp_socket(surl);
+		if (xsk.join_fd < 0)
+			goto fail;
+	}
+	xdp_ops.block_size = XDP_FRAME_SIZE;
+	return 0;
+
+fail:
+	xdp_close();
+	return -1;
+}
+
+static inline void xdp_refill(uint64_t addr)
+{
+	uint64_t *ring = xsk.fill.desc;
+	ring[xsk.fill.cached & xsk.fill.mask] = addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+	xsk.fill.cached++;
+	__atomic_store_n(xsk.fill.producer, xsk.fill.cached, __ATOMIC_RELEASE);
+}
+
+static int xdp_read(void **ptr, size_t *len)
+{
+	struct pollfd pfd = { .fd = xdp_ops.fd, .events = POLLIN };
+	struct xdp_desc *desc;
+	struct flow_key key;
+	const uint8_t *payload;
+	size_t plen;
+	uint16_t seq, off, rlen;
+
+	if (xsk.cur != XDP_NO_FRAME) {
+		xdp_refill(xsk.cur);
+		xsk.cur = XDP_NO_FRAME;
+	}
+	for (;;) {
+		while (xsk.rx.cached == __atomic_load_n(xsk.rx.producer, __ATOMIC_ACQUIRE)) {
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+				*ptr = NULL;
+				*len = 0;
+				return -1;
+			}
+		}
+		desc = (struct xdp_desc *)xsk.rx.desc + (xsk.rx.cached & xsk.rx.mask);
+		xsk.rx.cached++;
+		__atomic_store_n(xsk.rx.consumer, xsk.rx.cached, __ATOMIC_RELEASE);
+		xsk.frames++;
+		if (frame_udp_payload(xsk.umem + desc->addr, desc->len, &key, &payload, &plen) < 0 || plen == 0) {
+			xsk.invalid++;
+			xdp_refill(desc->addr);
+			continue;
+		}
+		if (payload[0] != TS_SYNC_BYTE && rtp_parse_header(payload, plen, &seq, &off, &rlen) == 0) {
+			payload += off;
+			plen = rlen;
+		}
+		xsk.cur = desc->addr;
+		*ptr = (void *)payload;
+		*len = plen;
+		return 0;
+	}
+}
+
+static int xdp_close(void)
+{
+	if (xsk.join_fd >= 0)
+		close(xsk.join_fd);
+	/* closing the link detaches the program */
+	if (xsk.link_fd >= 0)
+		close(xsk.link_fd);
+	if (xsk.prog_fd >= 0)
+		close(xsk.prog_fd);
+	if (xsk.map_fd >= 0)
+		close(xsk.map_fd);
+	if (xsk.rx.map != NULL)
+		munmap(xsk.rx.map, xsk.rx.map_len);
+	if (xsk.fill.map != NULL)
+		munmap(xsk.fill.map, xsk.fill.map_len);
+	if (xdp_ops.fd >= 0)
+		close(xdp_ops.fd);
+	if (xsk.umem != NULL)
+		munmap(xsk.umem, (size_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE);
+	memset(&xsk, 0, sizeof(xsk));
+	xsk.map_fd = xsk.prog_fd = xsk.link_fd = xsk.join_fd = -1;
+	xdp_ops.fd = -1;
+	return 0;
+}
+
+static int64_t xdp_end(void)
+{
+	return 1;
+}
+
+static void xdp_dump(void)
+{
+	struct xdp_statistics st;
+	socklen_t optlen = sizeof(st);
+
+	printf("\n");
+	printf("XDP queue %u, %s mode, %s:\n", xsk.queue, xsk.xdp_flags == XDP_FLAGS_DRV_MODE ? "native" : "generic",
+		   (xsk.bind_flags & XDP_ZEROCOPY) ? "zero copy" : "copy");
+	printf("%12s%12s", "Frames", "Invalid");
+	if (xdp_ops.fd >= 0 && getsockopt(xdp_ops.fd, SOL_XDP, XDP_STATISTICS, &st, &optlen) == 0) {
+		printf("%12s%12s%12s\n", "Dropped", "RingFull", "FillEmpty");
+		printf("%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "\n", xsk.frames, xsk.invalid,
+			   (uint64_t)st.rx_dropped, (uint64_t)st.rx_ring_full, (uint64_t)st.rx_fill_ring_empty_descs);
+	} else {
+		printf("\n%12" PRIu64 "%12" PRIu64 "\n", xsk.frames, xsk.invalid);
+	}
+}
+
+static struct io_ops xdp_ops = {
+	.type = IO_XDP,
+	.fd = -1,
+	.open = xdp_open,
+	.read = xdp_read,
+	.close = xdp_close,
+	.end = xdp_end,
+	.dump = xdp_dump,
+};
+
+REGISTER_IO_OPS(xdp, &xdp_ops);
+
+#endif
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "bufring.h"
+#include "io.h"
+#include "ts.h"
+
+/*
+ * gzip and zstd compressed TS files, told apart by their magic bytes. a
+ * decoder thread reads the file and decompresses into a ring of large
+ * buffers while ts_process() works on an earlier one, the plain stream is
+ * never written anywhere. concatenated gzip members and zstd frames are
+ * decoded one after the other. zstd needs a build with HAVE_ZSTD
+ */
+
+#define ZIP_BUFS (4)
+#define ZIP_DEFAULT_BLOCK (4 * 1024 * 1024)
+#define ZIP_MAX_BLOCK (1024 * 1024 * 1024) /* zlib counts in 32 bits */
+#define ZIP_IN_SIZE (1024 * 1024)
+
+static const uint8_t gzip_magic[] = { 0x1f, 0x8b };
+static const uint8_t zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+static struct io_ops zip_ops;
+
+static struct {
+	struct bufring ring;
+	int format; /* kept after close() for the dump */
+	int decoding; /* decoder state allocated */
+	uint8_t *in;
+	int eof;
+	int error;
+	int clean; /* the last member or frame was complete */
+	z_stream zs;
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zd;
+	ZSTD_inBuffer ib;
+#endif
+	uint64_t in_bytes;
+	uint64_t out_bytes;
+} zio;
+
+int zip_probe(const char *filename)
+{
+	uint8_t magic[4];
+	ssize_t n;
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return ZIP_NONE;
+	n = read(fd, magic, sizeof(magic));
+	close(fd);
+	if (n >= (ssize_t)sizeof(gzip_magic) && memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0)
+		return ZIP_GZIP;
+	if (n >= (ssize_t)sizeof(zstd_magic) && memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0)
+		return ZIP_ZSTD;
+	return ZIP_NONE;
+}
+
+/* next piece of the compressed file into zio.in, 0 at the end */
+static size_t zip_input(void)
+{
+	size_t got = 0;
+	ssize_t ret;
+
+	while (got < ZIP_IN_SIZE) {
+		ret = read(zip_ops.fd, zio.in + got, ZIP_IN_SIZE - got);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			printf("zip: read error %s\n", strerror(errno));
+			zio.error = 1;
+		}
+		if (ret <= 0) {
+			zio.eof = 1;
+			break;
+		}
+		got += (size_t)ret;
+	}
+	zio.in_bytes += got;
+	return got;
+}
+
+static size_t zip_gunzip(uint8_t *out, size_t size)
+{
+	z_stream *zs = &zio.zs;
+	int ret;
+
+	/* last member complete and nothing after it */
+	if (zio.eof && zs->avail_in == 0 && zio.clean)
+		return 0;
+	zs->next_out = out;
+	zs->avail_out = (uInt)size;
+	while (zs->avail_out > 0 && !zio.error) {
+		if (zs->avail_in == 0 && !zio.eof) {
+			zs->next_in = zio.in;
+			zs->avail_in = (uInt)zip_input();
+		}
+		ret = inflate(zs, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			zio.clean = 1;
+			if (zs->avail_in == 0 && !zio.eof) {
+				zs->next_in = zio.in;
+				zs->avail_in = (uInt)zip_input();
+			}
+			if (zs->avail_in == 0)
+				break;
+			/* another member follows */
+			inflateReset(zs);
+			continue;
+		}
+		/* no progress, everything buffered in zlib is out */
+		if (ret == Z_BUF_ERROR && zs->avail_in == 0 && zio.eof)
+			break;
+		/* what gzip(1) does with padding after the last member */
+		if (ret == Z_DATA_ERROR && zio.clean) {
+			printf("zip: trailing garbage ignored\n");
+			zio.eof = 1;
+			zs->avail_in = 0;
+			break;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			printf("zip: gzip data error %s\n", zs->msg != NULL ? zs->msg : "");
+			zio.error = 1;
+			break;
+		}
+		zio.clean = 0;
+	}
+	return size - zs->avail_out;
+}
+
+#ifdef HAVE_ZSTD
+static size_t zip_unzstd(uint8_t *out, size_t size)
+{
+	ZSTD_outBuffer ob = { out, size, 0 };
+	size_t ret, before;
+
+	while (ob.pos < ob.size && !zio.error) {
+		if (zio.ib.pos == zio.ib.size && !zio.eof) {
+			zio.ib.src = zio.in;
+			zio.ib.size = zip_input();
+			zio.ib.pos = 0;
+		}
+		before = ob.pos;
+		ret = ZSTD_decompressStream(zio.zd, &ob, &zio.ib);
+		if (ZSTD_isError(ret)) {
+			printf("zip: zstd data error %s\n", ZSTD_getErrorName(ret));
+			zio.error = 1;
+			break;
+		}
+		/* at the end, keep going only while the decoder still flushes */
+		if (zio.ib.pos == zio.ib.size && zio.eof && ob.pos == before)
+			break;
+		zio.clean = ret == 0;
+	}
+	return ob.pos;
+}
+#endif
+
+static ssize_t zip_fill(uint8_t *data, size_t size)
+{
+	size_t len;
+
+#ifdef HAVE_ZSTD
+	if (zio.format == ZIP_ZSTD)
+		len = zip_unzstd(data, size);
+	else
+#endif
+		len = zip_gunzip(data, size);
+	if (len == 0 && !zio.clean && !zio.error) {
+		printf("zip: %s ends in the middle of a stream\n", get_config()->name);
+		zio.error = 1;
+	}
+	zio.out_bytes += len;
+	/* what was decoded before an error is handed out first */
+	if (len == 0 && zio.error)
+		return -1;
+	return (ssize_t)len;
+}
+
+static int zip_decoder_init(void)
+{
+	if (zio.format == ZIP_GZIP) {
+		memset(&zio.zs, 0, sizeof(zio.zs));
+		/* 16: gzip wrapper, not raw deflate or zlib */
+		return inflateInit2(&zio.zs, 16 + MAX_WBITS) == Z_OK ? 0 : -1;
+	}
+#ifdef HAVE_ZSTD
+	zio.zd = ZSTD_createDStream();
+	if (zio.zd == NULL)
+		return -1;
+	ZSTD_initDStream(zio.zd);
+	return 0;
+#else
+	printf("zip: zstd support was not built in\n");
+	return -1;
+#endif
+}
+
+static int zipio_close(void);
+
+static int zipio_open(const char *name)
+{
+	struct tsa_config *tsaconf = get_config();
+	struct stat st;
+
+	if (name == NULL)
+		return -1;
+	memset(&zio, 0, sizeof(zio));
+	zio.format = zip_probe(name);
+	if (zio.format == ZIP_NONE)
+		return -1;
+	zip_ops.fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (zip_ops.fd < 0)
+		return -1;
+	if (fstat(zip_ops.fd, &st) == 0)
+		zip_ops.total_size = (uint64_t)st.st_size;
+	posix_fadvise(zip_ops.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	zip_ops.block_size = ZIP_DEFAULT_BLOCK;
+	if (tsaconf->mem)
+		zip_ops.block_size = (size_t)tsaconf->mem * 1024 * 1024;
+	if (zip_ops.block_size > ZIP_MAX_BLOCK)
+		zip_ops.block_size = ZIP_MAX_BLOCK;
+	zip_ops.offset = 0;
+
+	zio.in = malloc(ZIP_IN_SIZE);
+	if (zio.in == NULL)
+		goto fail;
+	if (zip_decoder_init() < 0)
+		goto fail;
+	zio.decoding = 1;
+	if (bufring_open(&zio.ring, ZIP_BUFS, zip_ops.block_size, 0, zip_fill, 0) < 0)
+		goto fail;
+	return 0;
+
+fail:
+	zipio_close();
+	return -1;
+}
+
+static int zipio_read(void **ptr, size_t *len)
+{
+	if (bufring_read(&zio.ring, ptr, len) < 0)
+		return -1;
+	zip_ops.ptr = *ptr;
+	zip_ops.offset += *len;
+	return 0;
+}
+
+static int zipio_close(void)
+{
+	bufring_close(&zio.ring);
+	if (zio.decoding && zio.format == ZIP_GZIP)
+		inflateEnd(&zio.zs);
+#ifdef HAVE_ZSTD
+	ZSTD_freeDStream(zio.zd);
+	zio.zd = NULL;
+#endif
+	zio.decoding = 0;
+	free(zio.in);
+	zio.in = NULL;
+	if (zip_ops.fd >= 0)
+		close(zip_ops.fd);
+	zip_ops.fd = -1;
+	zip_ops.ptr = NULL;
+	return 0;
+}
+
+static int64_t zipio_end(void)
+{
+	return bufring_end(&zio.ring);
+}
+
+static void zipio_dump(void)
+{
+	printf("\n");
+	printf("Compressed input:\n");
+	printf("%12s%16s%16s%10s%12s%12s\n", "Format", "In", "Out", "Ratio", "Starved", "Full");
+	printf("%12s%16" PRIu64 "%16" PRIu64 "%10.2f%12" PRIu64 "%12" PRIu64 "\n",
+		   zio.format == ZIP_ZSTD ? "zstd" : "gzip", zio.in_bytes, zio.out_bytes,
+		   zio.in_bytes ? (double)zio.out_bytes / (double)zio.in_bytes : 0.0, zio.ring.starved, zio.ring.waits);
+}
+
+static struct io_ops zip_ops = {
+	.type = IO_ZIP,
+	.fd = -1,
+	.open = zipio_open,
+	.read = zipio_read,
+	.close = zipio_close,
+	.end = zipio_end,
+	.dump = zipio_dump,
+};
+
+REGISTER_IO_OPS(zip, &zip_ops);